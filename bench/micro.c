@@ -0,0 +1,278 @@
+// bench/micro.c - in-process microbenchmarks for the protocol and libvm
+// Usage: micro [-f substring] [-s samples] [-t sample_ms] [-n max_vms]
+//
+// Every benchmark is calibrated to run about sample_ms per sample, then
+// timed over `samples` samples; ns/op is reported per sample as mean,
+// standard deviation, min, median and max. Results go to stdout as one
+// JSON document, progress to stderr, so two runs can be diffed by name.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "libvm.h"
+#include "protocol.h"
+#include "version.h"
+
+volatile sig_atomic_t g_running = 1;   // protocol.c's SHUTDOWN flag; never cleared here
+
+#define MAX_SAMPLES 101
+
+static const char *g_filter;
+static int    g_samples = 11;
+static double g_sample_ms = 20;
+static size_t g_max_vms = 1000000;
+static int    g_first = 1;
+
+static volatile size_t sink;           // keeps results observable to the compiler
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+typedef void (*bench_fn)(void *arg, size_t iters);
+
+// Calibrate, time, and print one JSON result object.
+static void run(const char *name, size_t n_vms, bench_fn fn, void *arg) {
+    if (g_filter && !strstr(name, g_filter)) return;
+    fprintf(stderr, "%s n=%zu\n", name, n_vms);
+
+    size_t iters = 1;
+    for (;;) {
+        double t = now_ns();
+        fn(arg, iters);
+        double el = now_ns() - t;
+        if (el >= g_sample_ms * 1e6 / 4 || iters >= ((size_t)1 << 32)) {
+            double per = el / (double)iters;
+            iters = per > 0 ? (size_t)(g_sample_ms * 1e6 / per) : iters;
+            if (iters < 1) iters = 1;
+            break;
+        }
+        iters *= 4;
+    }
+
+    double s[MAX_SAMPLES], sum = 0;
+    for (int i=0;i<g_samples;i++) {
+        double t = now_ns();
+        fn(arg, iters);
+        s[i] = (now_ns() - t) / (double)iters;
+        sum += s[i];
+    }
+    double mean = sum / g_samples, var = 0;
+    for (int i=0;i<g_samples;i++) var += (s[i] - mean) * (s[i] - mean);
+    var = g_samples > 1 ? var / (g_samples - 1) : 0;
+    qsort(s, (size_t)g_samples, sizeof(s[0]), cmp_double);
+
+    printf("%s\n    {\"name\": \"%s\", \"vms\": %zu, \"iters\": %zu, \"samples\": %d, "
+           "\"ns_per_op\": {\"mean\": %.2f, \"stddev\": %.2f, \"min\": %.2f, \"median\": %.2f, \"max\": %.2f}}",
+           g_first ? "" : ",", name, n_vms, iters, g_samples,
+           mean, sqrt(var), s[0], s[g_samples / 2], s[g_samples - 1]);
+    g_first = 0;
+    fflush(stdout);
+}
+
+// ----- protocol -----
+
+typedef struct {
+    const char *line;
+    size_t      len;
+    const char *key;
+} line_arg_t;
+
+static void b_handle_line(void *arg, size_t iters) {
+    const line_arg_t *a = arg;
+    char out[4096];
+    for (size_t i=0;i<iters;i++) sink += (size_t)protocol_handle_line(a->line, out, sizeof(out));
+}
+
+static void b_tokenize(void *arg, size_t iters) {
+    const line_arg_t *a = arg;
+    proto_req_t req;
+    for (size_t i=0;i<iters;i++) {
+        sink += (size_t)proto_tokenize(a->line, a->len, &req);
+        sink += req.nkv;
+    }
+}
+
+static void b_arg(void *arg, size_t iters) {
+    const line_arg_t *a = arg;
+    proto_req_t req;
+    proto_tokenize(a->line, a->len, &req);
+    for (size_t i=0;i<iters;i++) sink += (size_t)(proto_arg(&req, a->key) != NULL);
+}
+
+// VM.CREATE then VM.DESTROY of the new id: the store stays the same size.
+static void b_handle_churn(void *arg, size_t iters) {
+    (void)arg;
+    char out[4096], line[64];
+    for (size_t i=0;i<iters;i++) {
+        protocol_handle_line("VM.CREATE name=bench mem=256", out, sizeof(out));
+        int id = atoi(out + strlen("200 OK id="));
+        snprintf(line, sizeof(line), "VM.DESTROY id=%d", id);
+        sink += (size_t)protocol_handle_line(line, out, sizeof(out));
+    }
+}
+
+// Short form, and the same request padded with ignored key=value pairs
+// and a quoted value, so tokenizer cost shows up against handler cost.
+#define PAD " a=1 bb=22 ccc=333 dddd=4444 name2=\"quoted value with blanks\" e=5 f=6 g=7 h=8 i=9 j=10"
+
+static void bench_protocol(int id) {
+    char info[64], info_long[256];
+    snprintf(info, sizeof(info), "VM.INFO id=%d", id);
+    snprintf(info_long, sizeof(info_long), "VM.INFO id=%d" PAD, id);
+    const struct { const char *name, *line; } lines[] = {
+        { "handle/PING",            "PING" },
+        { "handle/VERSION",         "VERSION" },
+        { "handle/ECHO",            "ECHO hello" },
+        { "handle/ECHO/long",       "ECHO hello" PAD PAD },
+        { "handle/VM.INFO",         info },
+        { "handle/VM.INFO/long",    info_long },
+        { "handle/VM.LIST/limit10", "VM.LIST limit=10" },
+        { "handle/VM.LIST/long",    "VM.LIST limit=10" PAD },
+        { "handle/unknown",         "NOSUCH.VERB a=1" },
+        { "handle/STATS",           "STATS" },
+    };
+    for (size_t i=0;i<sizeof(lines)/sizeof(lines[0]);i++) {
+        line_arg_t a = { lines[i].line, strlen(lines[i].line), NULL };
+        run(lines[i].name, 100, b_handle_line, &a);
+    }
+    run("handle/VM.CREATE+DESTROY", 100, b_handle_churn, NULL);
+
+    line_arg_t shrt = { "VM.CREATE name=web mem=512", 0, "mem" };
+    line_arg_t lng  = { "VM.CREATE name=web mem=512" PAD, 0, "j" };
+    line_arg_t miss = { "VM.CREATE name=web mem=512" PAD, 0, "missing" };
+    shrt.len = strlen(shrt.line);
+    lng.len = strlen(lng.line);
+    miss.len = strlen(miss.line);
+    run("tokenize/short", 0, b_tokenize, &shrt);
+    run("tokenize/long", 0, b_tokenize, &lng);
+    run("arg/short", 0, b_arg, &shrt);
+    run("arg/long/last", 0, b_arg, &lng);
+    run("arg/long/miss", 0, b_arg, &miss);
+}
+
+// ----- libvm -----
+
+typedef struct {
+    int   *ids;
+    size_t n;
+    size_t pos;
+    vm_t  *buf;
+} vm_arg_t;
+
+static void b_vm_info(void *arg, size_t iters) {
+    vm_arg_t *a = arg;
+    vm_t v;
+    for (size_t i=0;i<iters;i++) {
+        sink += (size_t)vm_info(a->ids[a->pos], &v);
+        if (++a->pos == a->n) a->pos = 0;
+    }
+}
+
+static void b_vm_churn(void *arg, size_t iters) {
+    (void)arg;
+    for (size_t i=0;i<iters;i++) {
+        int id;
+        vm_create("bench", 256, &id);
+        sink += (size_t)vm_destroy(id);
+    }
+}
+
+static void b_vm_list(void *arg, size_t iters) {
+    vm_arg_t *a = arg;
+    size_t got;
+    for (size_t i=0;i<iters;i++) {
+        vm_list(a->buf, a->n, &got);
+        sink += got;
+    }
+}
+
+static void b_vm_list_page(void *arg, size_t iters) {
+    vm_arg_t *a = arg;
+    for (size_t i=0;i<iters;i++) {
+        size_t cursor = 0, got;
+        vm_list_from(&cursor, a->buf, 100, &got);
+        sink += got;
+    }
+}
+
+// Grow the store through each inventory size and measure it there.
+static void bench_libvm(void) {
+    int *ids = malloc(g_max_vms * sizeof(*ids));
+    vm_t *buf = malloc(g_max_vms * sizeof(*buf));
+    if (!ids || !buf) { perror("malloc"); exit(1); }
+    size_t have = 0;
+    srand(42);
+    for (size_t n = 10; n <= g_max_vms; n *= 10) {
+        for (; have < n; have++) {
+            char name[32];
+            snprintf(name, sizeof(name), "vm-%zu", have);
+            if (vm_create(name, 512, &ids[have]) != 0) { fprintf(stderr, "vm_create failed\n"); exit(1); }
+        }
+        // probe in shuffled order so the cache sees the store, not a walk
+        int *order = malloc(n * sizeof(*order));
+        if (!order) { perror("malloc"); exit(1); }
+        memcpy(order, ids, n * sizeof(*order));
+        for (size_t i=n; i>1; i--) {
+            size_t j = (size_t)rand() % i;
+            int t = order[i-1]; order[i-1] = order[j]; order[j] = t;
+        }
+        vm_arg_t a = { order, n, 0, buf };
+        char name[64];
+        snprintf(name, sizeof(name), "vm_info/%zu", n);           run(name, n, b_vm_info, &a);
+        snprintf(name, sizeof(name), "vm_create+destroy/%zu", n); run(name, n, b_vm_churn, &a);
+        snprintf(name, sizeof(name), "vm_list/%zu", n);           run(name, n, b_vm_list, &a);
+        snprintf(name, sizeof(name), "vm_list_from/100/%zu", n);  run(name, n, b_vm_list_page, &a);
+        free(order);
+    }
+    for (size_t i=0;i<have;i++) vm_destroy(ids[i]);
+    free(ids);
+    free(buf);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "f:s:t:n:h")) != -1) {
+        switch (opt) {
+        case 'f': g_filter = optarg; break;
+        case 's': g_samples = atoi(optarg); break;
+        case 't': g_sample_ms = atof(optarg); break;
+        case 'n': g_max_vms = strtoul(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [-f substring] [-s samples] [-t sample_ms] [-n max_vms]\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (g_samples < 1 || g_samples > MAX_SAMPLES || g_sample_ms <= 0 || g_max_vms < 10) {
+        fprintf(stderr, "need 1..%d samples, sample_ms > 0, max_vms >= 10\n", MAX_SAMPLES);
+        return 1;
+    }
+    if (vm_init() != 0) { fprintf(stderr, "vm_init failed\n"); return 1; }
+
+    printf("{\"suite\": \"hostd-micro\", \"version\": \"%s\", \"sample_ms\": %.1f, \"results\": [",
+           HOSTD_VERSION, g_sample_ms);
+
+    // the protocol runs against a small store with one known VM
+    int id = 0;
+    vm_create("probe", 512, &id);
+    for (int i=0;i<99;i++) { int x; vm_create("filler", 512, &x); }
+    bench_protocol(id);
+    vm_shutdown();
+    if (vm_init() != 0) { fprintf(stderr, "vm_init failed\n"); return 1; }
+
+    bench_libvm();
+    vm_shutdown();
+    printf("\n]}\n");
+    return 0;
+}
@@ -0,0 +1,72 @@
+// bench/vm_store.c - scaling check for the libvm stub store
+// Usage: vm_store [count]   (default 1000000)
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libvm.h"
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report(const char *op, size_t n, double secs) {
+    printf("%-8s n=%zu total=%.3fs per_op=%.1fns\n", op, n, secs, secs * 1e9 / (double)n);
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    int *ids = malloc(n * sizeof(*ids));
+    vm_t *arr = malloc(n * sizeof(*arr));
+    if (!ids || !arr) { perror("malloc"); return 1; }
+
+    vm_init();
+
+    double t = now_s();
+    for (size_t i=0;i<n;i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "vm-%zu", i);
+        if (vm_create(name, 512 + (int)(i % 8) * 512, &ids[i]) != 0) {
+            fprintf(stderr, "vm_create failed at %zu\n", i);
+            return 1;
+        }
+    }
+    report("create", n, now_s() - t);
+
+    // shuffled lookups so the cache sees the store, not a sequential walk
+    srand(42);
+    for (size_t i=n; i>1; i--) {
+        size_t j = (size_t)rand() % i;
+        int tmp = ids[i-1]; ids[i-1] = ids[j]; ids[j] = tmp;
+    }
+    vm_t v;
+    t = now_s();
+    for (size_t i=0;i<n;i++) {
+        if (vm_info(ids[i], &v) != 0) { fprintf(stderr, "vm_info miss\n"); return 1; }
+    }
+    report("lookup", n, now_s() - t);
+
+    size_t got = 0;
+    t = now_s();
+    vm_list(arr, n, &got);
+    report("list", got, now_s() - t);
+
+    long long mem[VM_STATE_COUNT];
+    size_t cnt[VM_STATE_COUNT];
+    t = now_s();
+    vm_mem_by_state(mem, cnt);
+    report("by-state", cnt[VM_STATE_STOPPED], now_s() - t);
+
+    t = now_s();
+    for (size_t i=0;i<n;i++) {
+        if (vm_destroy(ids[i]) != 0) { fprintf(stderr, "vm_destroy miss\n"); return 1; }
+    }
+    report("destroy", n, now_s() - t);
+
+    vm_shutdown();
+    free(ids);
+    free(arr);
+    return 0;
+}
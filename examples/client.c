@@ -0,0 +1,155 @@
+// examples/client.c - connection and framing helpers shared by vim-cmd and hostd-bench
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "client.h"
+#include "proto_bin.h"
+
+#ifndef _WIN32
+int client_connect_unix(const char *sock) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) { perror("socket(AF_UNIX)"); return -1; }
+    struct sockaddr_un addr; memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    size_t slen = strlen(sock);
+    if (slen >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "unix socket path too long (max %zu): %s\n",
+                sizeof(addr.sun_path) - 1, sock);
+        CLOSESOCK(fd);
+        return -1;
+    }
+    memcpy(addr.sun_path, sock, slen + 1);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect(unix)"); CLOSESOCK(fd); return -1;
+    }
+    return fd;
+}
+#endif
+
+int client_connect_tcp(const char *host, int port) {
+    char portstr[16]; snprintf(portstr, sizeof portstr, "%d", port);
+    struct addrinfo hints, *res=NULL;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int err = getaddrinfo(host, portstr, &hints, &res);
+    if (err) { fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err)); return -1; }
+
+    socket_t fd = (socket_t)-1;
+    for (struct addrinfo *ai=res; ai; ai=ai->ai_next) {
+        fd = (socket_t)socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if ((int)fd < 0) continue;
+        if (connect(fd, ai->ai_addr, (int)ai->ai_addrlen) == 0) { freeaddrinfo(res); return (int)fd; }
+        CLOSESOCK(fd); fd = (socket_t)-1;
+    }
+    freeaddrinfo(res);
+#ifdef _WIN32
+    fprintf(stderr, "connect(tcp) failed, WSAErr=%d\n", SOCKERR());
+#else
+    perror("connect(tcp)");
+#endif
+    return -1;
+}
+
+int client_send_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+#ifdef _WIN32
+        int k = send(fd, p, (int)n, 0);
+#else
+        ssize_t k = write(fd, p, n);
+#endif
+        if (k <= 0) return -1;
+        p += k; n -= (size_t)k;
+    }
+    return 0;
+}
+
+// 0, -1 on error, -2 when the server closed the connection
+int client_recv_all(int fd, char *p, size_t n) {
+    while (n > 0) {
+#ifdef _WIN32
+        int k = recv(fd, p, (int)n, 0);
+#else
+        ssize_t k = read(fd, p, n);
+#endif
+        if (k < 0) return -1;
+        if (k == 0) return -2;
+        p += k; n -= (size_t)k;
+    }
+    return 0;
+}
+
+// "PROTO binary" is the one text exchange on a binary connection. The
+// answer is read a byte at a time so nothing past it is consumed.
+int client_negotiate_binary(int fd) {
+    const char *req = "PROTO binary\n";
+    if (client_send_all(fd, req, strlen(req)) != 0) { fprintf(stderr, "PROTO: send failed\n"); return -1; }
+    char line[128];
+    size_t n = 0;
+    while (n + 1 < sizeof line) {
+        if (client_recv_all(fd, line + n, 1) != 0) { fprintf(stderr, "PROTO: no answer\n"); return -1; }
+        if (line[n++] == '\n') break;
+    }
+    line[n] = 0;
+    if (strncmp(line, "200 ", 4) != 0) { fprintf(stderr, "PROTO: %s", line); return -1; }
+    return 0;
+}
+
+// "VERB key=value value ..." as a request frame. Values may be double-quoted
+// to hold blanks (\" and \\ inside); on the wire they are raw bytes.
+int client_encode_request(const char *line, unsigned char *out, size_t outsz, size_t *outlen) {
+    const char *p = line;
+    size_t n = 4;
+    while (*p && isspace((unsigned char)*p)) p++;
+    const char *verb = p;
+    while (*p && !isspace((unsigned char)*p)) p++;
+    size_t vl = (size_t)(p - verb);
+    if (vl == 0 || vl > 255 || n + 2 + vl > outsz) return -1;
+    out[n++] = (unsigned char)vl;
+    memcpy(out + n, verb, vl); n += vl;
+    size_t nargs_at = n++;
+    unsigned nargs = 0;
+    for (;;) {
+        while (*p && isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+        const char *tok = p;
+        while (*p && !isspace((unsigned char)*p) && *p != '=' && *p != '"') p++;
+        size_t kl = 0;
+        if (*p == '=') { kl = (size_t)(p - tok); p++; }
+        else p = tok;           // positional
+        if (kl > 255 || nargs == 255 || n + 3 + kl > outsz) return -1;
+        out[n++] = (unsigned char)kl;
+        memcpy(out + n, tok, kl); n += kl;
+        size_t vlen_at = n;
+        n += 2;
+        size_t start = n;
+        if (*p == '"') {
+            for (p++; *p && *p != '"'; p++) {
+                if (*p == '\\' && p[1]) p++;
+                if (n == outsz) return -1;
+                out[n++] = (unsigned char)*p;
+            }
+            if (*p != '"') return -1;
+            p++;
+        } else {
+            while (*p && !isspace((unsigned char)*p)) {
+                if (n == outsz) return -1;
+                out[n++] = (unsigned char)*p++;
+            }
+        }
+        pb_put16(out + vlen_at, (uint16_t)(n - start));
+        nargs++;
+    }
+    out[nargs_at] = (unsigned char)nargs;
+    pb_put32(out, (uint32_t)(n - 4));
+    *outlen = n;
+    return 0;
+}
@@ -0,0 +1,38 @@
+// examples/client.h - connection and framing helpers shared by vim-cmd and hostd-bench
+#pragma once
+#include <stddef.h>
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
+  typedef SOCKET socket_t;
+  #define CLOSESOCK closesocket
+  #define SOCKERR() WSAGetLastError()
+#else
+  #include <unistd.h>
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <netdb.h>
+  #include <arpa/inet.h>
+  typedef int socket_t;
+  #define CLOSESOCK close
+  #define SOCKERR() errno
+#endif
+
+// Connected stream socket, or -1 (reason already on stderr).
+#ifndef _WIN32
+int client_connect_unix(const char *sock);
+#endif
+int client_connect_tcp(const char *host, int port);
+
+// Blocking I/O of exactly n bytes. 0, -1 on error; client_recv_all
+// returns -2 when the server closed the connection.
+int client_send_all(int fd, const char *p, size_t n);
+int client_recv_all(int fd, char *p, size_t n);
+
+// Switch a fresh connection to the binary framing (PROTO binary).
+int client_negotiate_binary(int fd);
+
+// Encode a text command line as a request frame, length prefix included.
+int client_encode_request(const char *line, unsigned char *out, size_t outsz, size_t *outlen);
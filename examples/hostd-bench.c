@@ -0,0 +1,488 @@
+// examples/hostd-bench.c - load generator for hostd with latency reporting
+// Build: make hostd-bench
+//
+// Closed loop (default): every connection keeps -d requests in flight and
+// sends the next one as soon as a reply comes back. Open loop (-r): the
+// requests go out on a fixed schedule whatever the server does, and each
+// latency is measured from the time the request was due, not the time it
+// was finally written, so a stalled server cannot hide its stall by
+// slowing the client down (coordinated omission).
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "client.h"
+#include "proto_bin.h"
+#include "hist.h"
+
+#define MAX_THREADS 256
+#define QMAX        4096            // requests in flight per connection
+#define OUT_CAP     (64 * 1024)
+#define IN_INIT     (16 * 1024)     // grows for long VM.LIST lines
+#define REQ_MAX     256
+#define CHURN_KEEP  32              // VMs a connection keeps alive for DESTROY to hit
+#define DRAIN_NS    5000000000ull   // wait this long for late replies at the end
+
+enum { OP_PING, OP_LIST, OP_CREATE, OP_DESTROY, NOPS, OP_CLEANUP = NOPS };
+static const char *const op_names[NOPS] = { "PING", "VM.LIST", "VM.CREATE", "VM.DESTROY" };
+
+enum { PHASE_RUN, PHASE_DRAIN, PHASE_CLEANUP };
+
+// ----- options -----
+static const char *g_sock = "/tmp/hostd.sock";
+static char     g_host[128];
+static int      g_port;
+static int      g_conns = 8;
+static int      g_threads;
+static int      g_depth = 1;
+static double   g_rate;             // total requests/s; 0: closed loop
+static double   g_secs = 10;
+static int      g_list_limit = 100;
+static bool     g_binary;
+static unsigned g_weight[3] = { 80, 5, 15 };   // ping, list, churn
+
+typedef struct {
+    int      fd;
+    int      dead;
+    uint8_t  qop[QMAX];             // in flight, oldest first
+    uint64_t qts[QMAX];             // when each was sent (closed) or due (open)
+    uint32_t qhead, qtail;
+    char    *in;
+    size_t   ilen, icap;
+    char     out[OUT_CAP];
+    size_t   olen, ooff;
+    int      ids[CHURN_KEEP + QMAX];
+    int      nids, creating;
+    uint64_t next;                  // open loop: when the next request is due
+    uint64_t interval;
+    uint64_t rng;
+    unsigned seq;
+} bconn_t;
+
+typedef struct {
+    int        id;
+    pthread_t  th;
+    bconn_t   *conns;
+    int        nconns;
+    int        ep;
+    hist_t     all;
+    hist_t     lat[NOPS];
+    uint64_t   count[NOPS], errors[NOPS];
+    uint64_t   lost;                // in flight on a connection that died
+    uint64_t   last_done;
+} worker_t;
+
+static uint64_t g_start, g_deadline;
+static pthread_barrier_t g_barrier;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    return *s = x;
+}
+
+// ----- requests -----
+
+static uint32_t inflight(const bconn_t *c) { return c->qtail - c->qhead; }
+
+static int pick_op(bconn_t *c) {
+    unsigned total = g_weight[0] + g_weight[1] + g_weight[2];
+    unsigned r = (unsigned)(xorshift(&c->rng) % total);
+    if (r < g_weight[0]) return OP_PING;
+    if (r < g_weight[0] + g_weight[1]) return OP_LIST;
+    // churn: keep a few VMs per connection and destroy the oldest
+    if (c->nids > 0 && (c->nids + c->creating >= CHURN_KEEP || (xorshift(&c->rng) & 1))) return OP_DESTROY;
+    return OP_CREATE;
+}
+
+static int format_op(worker_t *w, bconn_t *c, int op, char *line) {
+    switch (op) {
+    case OP_PING:   return snprintf(line, REQ_MAX, "PING");
+    case OP_LIST:
+        return g_list_limit ? snprintf(line, REQ_MAX, "VM.LIST limit=%d", g_list_limit)
+                            : snprintf(line, REQ_MAX, "VM.LIST");
+    case OP_CREATE:
+        return snprintf(line, REQ_MAX, "VM.CREATE name=bench-%d-%ld-%u mem=64", w->id, (long)(c - w->conns), c->seq++);
+    default: {
+        int id = c->ids[0];
+        memmove(c->ids, c->ids + 1, (size_t)--c->nids * sizeof(int));
+        return snprintf(line, REQ_MAX, "VM.DESTROY id=%d", id);
+    }
+    }
+}
+
+// Queue one request due at `due`; false when the connection cannot take more.
+static bool issue(worker_t *w, bconn_t *c, int op, uint64_t due) {
+    if (c->dead || inflight(c) == QMAX || OUT_CAP - c->olen < REQ_MAX + 8) return false;
+    if (op == OP_CLEANUP && c->nids == 0) return false;
+    char line[REQ_MAX];
+    int n = format_op(w, c, op == OP_CLEANUP ? OP_DESTROY : op, line);
+    if (g_binary) {
+        size_t len;
+        if (client_encode_request(line, (unsigned char *)c->out + c->olen, OUT_CAP - c->olen, &len) != 0) return false;
+        c->olen += len;
+    } else {
+        memcpy(c->out + c->olen, line, (size_t)n);
+        c->out[c->olen + (size_t)n] = '\n';
+        c->olen += (size_t)n + 1;
+    }
+    if (op == OP_CREATE) c->creating++;
+    c->qop[c->qtail % QMAX] = (uint8_t)op;
+    c->qts[c->qtail % QMAX] = due;
+    c->qtail++;
+    return true;
+}
+
+static void flush(bconn_t *c) {
+    while (!c->dead && c->ooff < c->olen) {
+        ssize_t n = write(c->fd, c->out + c->ooff, c->olen - c->ooff);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) c->dead = 1;
+            return;
+        }
+        c->ooff += (size_t)n;
+    }
+    c->ooff = c->olen = 0;
+}
+
+// Closed loop: top the pipeline back up to -d.
+static void refill(worker_t *w, bconn_t *c) {
+    while (inflight(c) < (uint32_t)g_depth && issue(w, c, pick_op(c), now_ns())) {}
+}
+
+// ----- replies -----
+
+// Length of the next complete reply in buf, 0 if none yet. A text reply
+// is one line; a binary one ends with any frame but VM.LIST records.
+static size_t next_reply(const char *buf, size_t len, int *ok, int *id) {
+    *id = -1;
+    if (!g_binary) {
+        const char *nl = memchr(buf, '\n', len);
+        if (!nl) return 0;
+        *ok = len >= 3 && memcmp(buf, "200", 3) == 0;
+        if (*ok && sscanf(buf, "200 OK id=%d", id) != 1) *id = -1;
+        return (size_t)(nl - buf) + 1;
+    }
+    size_t off = 0;
+    while (len - off >= 6) {
+        const unsigned char *f = (const unsigned char *)buf + off;
+        size_t flen = pb_get32(f);
+        if (len - off < 4 + flen) return 0;
+        off += 4 + flen;
+        if (f[5] == PB_T_VMS) continue;
+        *ok = f[4] == PB_OK;
+        if (*ok && f[5] == PB_T_ID && flen >= 6) *id = (int)pb_get32(f + 6);
+        return off;
+    }
+    return 0;
+}
+
+static void complete(worker_t *w, bconn_t *c, int ok, int id, uint64_t now) {
+    uint32_t k = c->qhead++ % QMAX;
+    int op = c->qop[k];
+    if (op == OP_CREATE) {
+        c->creating--;
+        if (ok && id >= 0) c->ids[c->nids++] = id;
+    }
+    if (op == OP_CLEANUP) return;
+    uint64_t lat = now > c->qts[k] ? now - c->qts[k] : 0;
+    hist_record(&w->all, lat);
+    hist_record(&w->lat[op], lat);
+    w->count[op]++;
+    if (!ok) w->errors[op]++;
+    w->last_done = now;
+}
+
+static void drop_conn(worker_t *w, bconn_t *c) {
+    c->dead = 1;
+    w->lost += inflight(c);
+    c->qhead = c->qtail;
+    epoll_ctl(w->ep, EPOLL_CTL_DEL, c->fd, NULL);
+}
+
+static void on_readable(worker_t *w, bconn_t *c, int phase) {
+    while (!c->dead) {
+        if (c->ilen == c->icap) {
+            char *p = realloc(c->in, c->icap * 2);
+            if (!p) { drop_conn(w, c); return; }
+            c->in = p;
+            c->icap *= 2;
+        }
+        ssize_t n = read(c->fd, c->in + c->ilen, c->icap - c->ilen);
+        if (n == 0) { fprintf(stderr, "server closed a connection\n"); drop_conn(w, c); return; }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) drop_conn(w, c);
+            return;
+        }
+        c->ilen += (size_t)n;
+
+        uint64_t now = now_ns();
+        size_t used = 0, k;
+        int ok, id;
+        while (inflight(c) > 0 && (k = next_reply(c->in + used, c->ilen - used, &ok, &id)) > 0) {
+            used += k;
+            complete(w, c, ok, id, now);
+        }
+        memmove(c->in, c->in + used, c->ilen - used);
+        c->ilen -= used;
+        if (phase == PHASE_RUN && g_rate == 0) refill(w, c);
+        flush(c);
+    }
+}
+
+// ----- worker loop -----
+
+static bool idle(const worker_t *w, int phase) {
+    for (int i=0;i<w->nconns;i++) {
+        const bconn_t *c = &w->conns[i];
+        if (c->dead) continue;
+        if (inflight(c) || (phase == PHASE_CLEANUP && c->nids)) return false;
+    }
+    return true;
+}
+
+// Open loop: send everything that has come due. A connection that is
+// full falls behind its schedule and catches up later; the latency of
+// those requests still counts from when they were due.
+static int issue_due(worker_t *w, uint64_t now) {
+    uint64_t earliest = UINT64_MAX;
+    for (int i=0;i<w->nconns;i++) {
+        bconn_t *c = &w->conns[i];
+        while (c->next <= now && c->next < g_deadline && issue(w, c, pick_op(c), c->next)) c->next += c->interval;
+        flush(c);
+        if (c->next < earliest) earliest = c->next;
+    }
+    if (earliest <= now) return 0;
+    uint64_t ms = (earliest - now) / 1000000u;
+    return ms > 100 ? 100 : (int)ms;    // under 1 ms: spin
+}
+
+static void run_phase(worker_t *w, int phase) {
+    struct epoll_event evs[64];
+    uint64_t limit = phase == PHASE_RUN ? g_deadline : now_ns() + DRAIN_NS;
+    if (phase == PHASE_RUN && g_rate == 0)
+        for (int i=0;i<w->nconns;i++) { refill(w, &w->conns[i]); flush(&w->conns[i]); }
+    for (;;) {
+        uint64_t now = now_ns();
+        if (now >= limit) break;
+        if (phase != PHASE_RUN && idle(w, phase)) break;
+        int timeout = 100;
+        if (phase == PHASE_RUN && g_rate > 0) timeout = issue_due(w, now);
+        if (phase == PHASE_CLEANUP)
+            for (int i=0;i<w->nconns;i++) {
+                bconn_t *c = &w->conns[i];
+                while (issue(w, c, OP_CLEANUP, now)) {}
+                flush(c);
+            }
+        int n = epoll_wait(w->ep, evs, 64, timeout);
+        for (int i=0;i<n;i++) {
+            bconn_t *c = evs[i].data.ptr;
+            if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) on_readable(w, c, phase);
+            if (evs[i].events & EPOLLOUT) flush(c);
+        }
+    }
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    pthread_barrier_wait(&g_barrier);
+    run_phase(w, PHASE_RUN);
+    run_phase(w, PHASE_DRAIN);
+    // a connection still owing replies is out of step; give it up
+    for (int i=0;i<w->nconns;i++)
+        if (!w->conns[i].dead && inflight(&w->conns[i])) drop_conn(w, &w->conns[i]);
+    run_phase(w, PHASE_CLEANUP);
+    return NULL;
+}
+
+// ----- setup -----
+
+static int open_conn(bconn_t *c) {
+    int fd = g_port ? client_connect_tcp(g_host, g_port) : client_connect_unix(g_sock);
+    if (fd < 0) return -1;
+    if (g_binary && client_negotiate_binary(fd) != 0) { close(fd); return -1; }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    c->fd = fd;
+    c->icap = IN_INIT;
+    c->in = malloc(c->icap);
+    return c->in ? 0 : -1;
+}
+
+static int parse_mix(const char *spec) {
+    unsigned w[3] = {0};
+    char *dup = strdup(spec), *save = NULL;
+    if (!dup) return -1;
+    for (char *tok = strtok_r(dup, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) { free(dup); return -1; }
+        *eq = 0;
+        unsigned v = (unsigned)strtoul(eq + 1, NULL, 10);
+        if (!strcasecmp(tok, "ping")) w[0] = v;
+        else if (!strcasecmp(tok, "list")) w[1] = v;
+        else if (!strcasecmp(tok, "churn")) w[2] = v;
+        else { free(dup); return -1; }
+    }
+    free(dup);
+    if (w[0] + w[1] + w[2] == 0) return -1;
+    memcpy(g_weight, w, sizeof(w));
+    return 0;
+}
+
+// ----- report -----
+
+static void print_row(const char *name, uint64_t count, uint64_t errors, const hist_t *h) {
+    printf("  %-10s %10llu %8llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+           (unsigned long long)count, (unsigned long long)errors,
+           hist_quantile(h, 0.5) / 1e3, hist_quantile(h, 0.9) / 1e3, hist_quantile(h, 0.99) / 1e3,
+           hist_quantile(h, 0.999) / 1e3, h->max / 1e3);
+}
+
+// HdrHistogram-style percentile spectrum: two rows each time the distance
+// to 100% halves, down to the single slowest request.
+static void print_spectrum(const hist_t *h) {
+    printf("latency distribution (us):\n  %12s %12s %12s\n", "value", "percentile", "count");
+    uint64_t total = h->count;
+    for (double frac = 0.5; frac * (double)total >= 1; frac /= 2) {
+        double ps[2] = { 1 - frac, 1 - frac * 0.75 };
+        for (int k=0;k<2;k++)
+            printf("  %12.1f %12.6f %12llu\n", hist_quantile(h, ps[k]) / 1e3, ps[k],
+                   (unsigned long long)(ps[k] * (double)total + 0.5));
+    }
+    printf("  %12.1f %12.6f %12llu\n", h->max / 1e3, 1.0, (unsigned long long)total);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-S socket | -T host:port] [-c conns] [-t threads] [-d depth]\n"
+        "          [-r rate] [-D seconds] [-m ping=80,list=5,churn=15] [-L limit] [-b]\n"
+        "  -c  connections (default 8)\n"
+        "  -t  threads (default: one per connection, up to 4)\n"
+        "  -d  closed loop: requests in flight per connection (default 1)\n"
+        "  -r  open loop: total requests/s on a fixed schedule; -d is ignored\n"
+        "  -D  run time in seconds (default 10)\n"
+        "  -m  weighted mix; churn creates VMs and destroys them again\n"
+        "  -L  VM.LIST limit= (default 100, 0: whole table)\n"
+        "  -b  use the binary framing (PROTO binary)\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "S:T:c:t:d:r:D:m:L:bh")) != -1) {
+        switch (opt) {
+        case 'S': g_sock = optarg; g_port = 0; break;
+        case 'T': {
+            const char *colon = strrchr(optarg, ':');
+            if (!colon || (size_t)(colon - optarg) >= sizeof(g_host)) { fprintf(stderr, "-T expects host:port\n"); return 1; }
+            memcpy(g_host, optarg, (size_t)(colon - optarg));
+            g_host[colon - optarg] = 0;
+            g_port = atoi(colon + 1);
+            break;
+        }
+        case 'c': g_conns = atoi(optarg); break;
+        case 't': g_threads = atoi(optarg); break;
+        case 'd': g_depth = atoi(optarg); break;
+        case 'r': g_rate = atof(optarg); break;
+        case 'D': g_secs = atof(optarg); break;
+        case 'm': if (parse_mix(optarg) != 0) { fprintf(stderr, "bad -m %s\n", optarg); return 1; } break;
+        case 'L': g_list_limit = atoi(optarg); break;
+        case 'b': g_binary = true; break;
+        case 'h': default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (g_conns < 1 || g_depth < 1 || g_depth > QMAX || g_secs <= 0 || g_rate < 0 || g_list_limit < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (g_threads <= 0) g_threads = g_conns < 4 ? g_conns : 4;
+    if (g_threads > g_conns) g_threads = g_conns;
+    if (g_threads > MAX_THREADS) g_threads = MAX_THREADS;
+
+    worker_t *ws = calloc((size_t)g_threads, sizeof(*ws));
+    bconn_t *conns = calloc((size_t)g_conns, sizeof(*conns));
+    if (!ws || !conns) { perror("calloc"); return 1; }
+    for (int i=0;i<g_conns;i++) {
+        if (open_conn(&conns[i]) != 0) return 2;
+        conns[i].rng = 0x9E3779B97F4A7C15ull * (uint64_t)(i + 1);
+    }
+
+    // each worker drives a contiguous slice of the connections
+    for (int t=0, at=0; t<g_threads; t++) {
+        worker_t *w = &ws[t];
+        w->id = t;
+        w->conns = conns + at;
+        w->nconns = g_conns / g_threads + (t < g_conns % g_threads);
+        at += w->nconns;
+        w->ep = epoll_create1(EPOLL_CLOEXEC);
+        for (int i=0;i<w->nconns;i++) {
+            struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = &w->conns[i] };
+            if (w->ep < 0 || epoll_ctl(w->ep, EPOLL_CTL_ADD, w->conns[i].fd, &ev) < 0) { perror("epoll"); return 1; }
+        }
+    }
+
+    pthread_barrier_init(&g_barrier, NULL, (unsigned)g_threads + 1);
+    for (int t=0;t<g_threads;t++) pthread_create(&ws[t].th, NULL, worker_main, &ws[t]);
+    g_start = now_ns();
+    g_deadline = g_start + (uint64_t)(g_secs * 1e9);
+    if (g_rate > 0) {
+        // stagger the connections evenly across one interval
+        uint64_t interval = (uint64_t)((double)g_conns * 1e9 / g_rate);
+        for (int i=0;i<g_conns;i++) {
+            conns[i].interval = interval ? interval : 1;
+            conns[i].next = g_start + interval * (uint64_t)i / (uint64_t)g_conns;
+        }
+    }
+    pthread_barrier_wait(&g_barrier);
+    for (int t=0;t<g_threads;t++) pthread_join(ws[t].th, NULL);
+
+    hist_t all = {0}, lat[NOPS];
+    memset(lat, 0, sizeof(lat));
+    uint64_t count[NOPS] = {0}, errors[NOPS] = {0}, lost = 0, last = g_start;
+    for (int t=0;t<g_threads;t++) {
+        hist_merge(&all, &ws[t].all);
+        for (int k=0;k<NOPS;k++) {
+            hist_merge(&lat[k], &ws[t].lat[k]);
+            count[k] += ws[t].count[k];
+            errors[k] += ws[t].errors[k];
+        }
+        lost += ws[t].lost;
+        if (ws[t].last_done > last) last = ws[t].last_done;
+    }
+    uint64_t total = all.count, nerr = lost;
+    for (int k=0;k<NOPS;k++) nerr += errors[k];
+    double secs = (double)(last - g_start) / 1e9;
+
+    char target[192];
+    if (g_port) snprintf(target, sizeof target, "tcp %s:%d", g_host, g_port);
+    else snprintf(target, sizeof target, "unix %s", g_sock);
+    printf("hostd-bench: %s, %d connections, %d threads, %s, %s framing\n", target, g_conns, g_threads,
+           g_rate > 0 ? "open loop" : "closed loop", g_binary ? "binary" : "text");
+    if (g_rate > 0) printf("schedule: %.1f req/s for %.1f s\n", g_rate, g_secs);
+    else printf("pipeline: depth %d for %.1f s\n", g_depth, g_secs);
+    printf("mix: ping=%u list=%u churn=%u\n", g_weight[0], g_weight[1], g_weight[2]);
+    printf("requests: %llu in %.2f s = %.1f req/s, errors %llu (lost %llu)\n",
+           (unsigned long long)total, secs, secs > 0 ? (double)total / secs : 0.0,
+           (unsigned long long)nerr, (unsigned long long)lost);
+    printf("  %-10s %10s %8s %9s %9s %9s %9s %9s  (us)\n", "op", "count", "errors", "p50", "p90", "p99", "p99.9", "max");
+    for (int k=0;k<NOPS;k++) if (count[k]) print_row(op_names[k], count[k], errors[k], &lat[k]);
+    print_row("all", total, nerr, &all);
+    if (total) print_spectrum(&all);
+    return nerr ? 3 : 0;
+}
@@ -1,6 +1,6 @@
 // examples/vim-cmd.c - cross-platform client for hostd with config + REPL + set
-// Build (Unix):    cc -Wall -Wextra -O2 -g -Iinclude -o vim-cmd examples/vim-cmd.c
-// Build (MinGW):   x86_64-w64-mingw32-gcc -O2 -o vim-cmd.exe examples/vim-cmd.c -lws2_32
+// Build (Unix):    cc -Wall -Wextra -O2 -g -Iinclude -o vim-cmd examples/vim-cmd.c examples/client.c
+// Build (MinGW):   x86_64-w64-mingw32-gcc -O2 -Iinclude -o vim-cmd.exe examples/vim-cmd.c examples/client.c -lws2_32
 
 #define _POSIX_C_SOURCE 200809L
 
@@ -10,32 +10,24 @@
 #include <ctype.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "client.h"
+#include "proto_bin.h"
 
 #ifdef _WIN32
-  #define WIN32_LEAN_AND_MEAN
-  #include <winsock2.h>
-  #include <ws2tcpip.h>
   #include <windows.h>
   #pragma comment(lib, "ws2_32.lib")
-  typedef SOCKET socket_t;
-  #define CLOSESOCK closesocket
-  #define SOCKERR() WSAGetLastError()
   #define PATH_SEP '\\'
 #else
-  #include <unistd.h>
-  #include <sys/socket.h>
-  #include <sys/un.h>
-  #include <netdb.h>
-  #include <arpa/inet.h>
   #include <pwd.h>
   #include <sys/stat.h>
   #include <sys/types.h>
-  typedef int socket_t;
-  #define CLOSESOCK close
-  #define SOCKERR() errno
   #define PATH_SEP '/'
 #endif
 
+static bool g_binary = false;   // -b: framed protocol (include/proto_bin.h)
+
 // ----- Modes -----
 typedef enum { VC_MODE_UNSET=0, VC_MODE_UNIX=1, VC_MODE_TCP=2 } vc_mode_t;
 
@@ -195,72 +187,120 @@ static int cfg_write_file(const cfg_t *c, const char *path) {
 }
 
 // ----- connections -----
+static int connect_transport(const cfg_t *c) {
+    if (c->mode == VC_MODE_TCP) {
+        if (!c->host[0] || c->port<=0) { fprintf(stderr, "tcp config incomplete\n"); return -1; }
+        return client_connect_tcp(c->host, c->port);
+    }
 #ifndef _WIN32
-static int connect_unix_path(const char *sock) {
-    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (fd < 0) { perror("socket(AF_UNIX)"); return -1; }
-    struct sockaddr_un addr; memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-
-    size_t slen = strlen(sock);
-    if (slen >= sizeof(addr.sun_path)) {
-        fprintf(stderr, "unix socket path too long (max %zu): %s\n",
-                sizeof(addr.sun_path) - 1, sock);
-        CLOSESOCK(fd);
-        return -1;
+    if (c->mode == VC_MODE_UNIX) {
+        if (!c->socket_path[0]) { fprintf(stderr, "unix socket path missing\n"); return -1; }
+        return client_connect_unix(c->socket_path);
     }
-    memcpy(addr.sun_path, sock, slen + 1);
+#endif
+    fprintf(stderr, "no valid mode\n");
+    return -1;
+}
 
-    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("connect(unix)"); CLOSESOCK(fd); return -1;
-    }
+static int connect_from_cfg(const cfg_t *c) {
+    int fd = connect_transport(c);
+    if (fd >= 0 && g_binary && client_negotiate_binary(fd) != 0) { CLOSESOCK(fd); return -1; }
     return fd;
 }
-#endif
-
-static int connect_tcp_host(const char *host, int port) {
-    char portstr[16]; snprintf(portstr, sizeof portstr, "%d", port);
-    struct addrinfo hints, *res=NULL;
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
 
-    int err = getaddrinfo(host, portstr, &hints, &res);
-    if (err) { fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err)); return -1; }
+static void print_vm(const unsigned char *r, const char *prefix) {
+    static const char *const states[] = { "stopped", "running", "paused" };
+    int nlen = r[9] < PB_VM_NAME ? r[9] : PB_VM_NAME;
+    printf("%sid=%d name=%.*s mem=%d state=%s\n", prefix, (int)pb_get32(r), nlen, (const char *)r + 10,
+           (int)pb_get32(r + 4), r[8] < 3 ? states[r[8]] : "unknown");
+}
 
-    socket_t fd = (socket_t)-1;
-    for (struct addrinfo *ai=res; ai; ai=ai->ai_next) {
-        fd = (socket_t)socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-        if ((int)fd < 0) continue;
-        if (connect(fd, ai->ai_addr, (int)ai->ai_addrlen) == 0) { freeaddrinfo(res); return (int)fd; }
-        CLOSESOCK(fd); fd = (socket_t)-1;
+// Same output as the text protocol, decoded from fixed-layout frames.
+// Inside a batch reply each TAG frame prefixes the next reply with "#i ".
+static int send_command_bin(int fd, const char *line, bool await) {
+    unsigned char buf[4 + PB_MAX_FRAME];
+    size_t len;
+    if (client_encode_request(line, buf, sizeof buf, &len) != 0) { fprintf(stderr, "malformed or oversized request\n"); return -1; }
+    if (client_send_all(fd, (const char *)buf, len) != 0) { fprintf(stderr, "send failed\n"); return -1; }
+    if (!await) return 0;
+
+    char tag[24] = "", pfx[40];
+    bool tagged = false;
+    for (;;) {
+        int rc = client_recv_all(fd, (char *)buf, 4);
+        if (rc == 0) {
+            len = pb_get32(buf);
+            if (len < 2 || len > PB_MAX_FRAME) { fprintf(stderr, "bad frame length %zu\n", len); return -1; }
+            rc = client_recv_all(fd, (char *)buf + 4, len);
+        }
+        if (rc == -2) { fprintf(stderr, "server closed connection\n"); return -2; }
+        if (rc < 0) { fprintf(stderr, "read failed\n"); return -1; }
+
+        const unsigned char *b = buf + 6;
+        size_t blen = len - 2;
+        switch (buf[5]) {
+        case PB_T_TAG:
+            if (blen < 4) break;
+            snprintf(tag, sizeof tag, "#%u ", (unsigned)pb_get32(b));
+            tagged = true;
+            continue;
+        case PB_T_LINE:
+            printf("%s%.*s\n", tag, (int)blen, (const char *)b);
+            continue;           // more lines, then the closing MSG frame
+        case PB_T_MSG:
+            printf("%s%s %.*s\n", tag, buf[4] == PB_OK ? "200 OK" : "400 ERR", (int)blen, (const char *)b);
+            goto done;
+        case PB_T_ID:
+            if (blen < 4) break;
+            printf("%s200 OK id=%d\n", tag, (int)pb_get32(b));
+            goto done;
+        case PB_T_VM:
+            if (blen < PB_VM_SIZE) break;
+            snprintf(pfx, sizeof pfx, "%s200 OK ", tag);
+            print_vm(b, pfx);
+            goto done;
+        case PB_T_VMS: {
+            if (blen < 2) break;
+            size_t cnt = pb_get16(b);
+            if (blen < 2 + cnt * PB_VM_SIZE) break;
+            snprintf(pfx, sizeof pfx, "%sVM ", tag);
+            for (size_t i=0;i<cnt;i++) print_vm(b + 2 + i * PB_VM_SIZE, pfx);
+            continue;           // more records or the END frame follow
+        }
+        case PB_T_END:
+            if (blen < 8) break;
+            printf("%s200 OK end count=%u next=%u\n", tag, (unsigned)pb_get32(b), (unsigned)pb_get32(b + 4));
+            goto done;
+        default:
+            fprintf(stderr, "unknown frame type %d\n", buf[5]);
+            return 0;
+        }
+        fprintf(stderr, "short frame (type %d)\n", buf[5]);
+        return -1;
+    done:
+        if (!tagged) return 0;  // a batch ends with its untagged summary
+        tagged = false;
+        tag[0] = 0;
     }
-    freeaddrinfo(res);
-#ifdef _WIN32
-    fprintf(stderr, "connect(tcp) failed, WSAErr=%d\n", SOCKERR());
-#else
-    perror("connect(tcp)");
-#endif
-    return -1;
 }
 
-static int connect_from_cfg(const cfg_t *c) {
-    if (c->mode == VC_MODE_TCP) {
-        if (!c->host[0] || c->port<=0) { fprintf(stderr, "tcp config incomplete\n"); return -1; }
-        return connect_tcp_host(c->host, c->port);
-    }
-#ifndef _WIN32
-    if (c->mode == VC_MODE_UNIX) {
-        if (!c->socket_path[0]) { fprintf(stderr, "unix socket path missing\n"); return -1; }
-        return connect_unix_path(c->socket_path);
+// Replies to a BATCH all arrive after its last command, so the BATCH line
+// and the commands before the last one are sent without waiting.
+static long g_batch_left = 0;
+
+static bool awaits_reply(const char *line) {
+    if (g_batch_left > 0) return --g_batch_left == 0;
+    while (isspace((unsigned char)*line)) line++;
+    if (!strncasecmp(line, "BATCH", 5) && isspace((unsigned char)line[5])) {
+        long n = strtol(line + 6, NULL, 10);
+        if (n > 0) { g_batch_left = n; return false; }
     }
-#endif
-    fprintf(stderr, "no valid mode\n");
-    return -1;
+    return true;
 }
 
-// ----- I/O -----
 static int send_command_fd(int fd, const char *line) {
+    bool await = awaits_reply(line);
+    if (g_binary) return send_command_bin(fd, line, await);
     size_t len = strlen(line);
 #ifdef _WIN32
     if (len==0 || line[len-1] != '\n') {
@@ -277,19 +317,32 @@ static int send_command_fd(int fd, const char *line) {
         if (write(fd, line, len) < 0) return -1;
     }
 #endif
+    if (!await) return 0;
 
+    // A reply ends with its status line ("200 ..." / "400 ..."); a long
+    // VM.LIST line or a stream of "VM ..." records arrives over many reads.
     char buf[8192];
+    int at_bol = 1, status_line = 0;
+    for (;;) {
 #ifdef _WIN32
-    int n = recv(fd, buf, (int)sizeof(buf)-1, 0);
-    if (n < 0) { fprintf(stderr, "recv failed, WSAErr=%d\n", SOCKERR()); return -1; }
+        int n = recv(fd, buf, (int)sizeof(buf)-1, 0);
+        if (n < 0) { fprintf(stderr, "recv failed, WSAErr=%d\n", SOCKERR()); return -1; }
 #else
-    ssize_t n = read(fd, buf, sizeof(buf)-1);
-    if (n < 0) { perror("read"); return -1; }
-#endif
-    if (n == 0) { fprintf(stderr, "server closed connection\n"); return -2; }
-    buf[n] = 0;
-    fputs(buf, stdout);
-    return 0;
+        ssize_t n = read(fd, buf, sizeof(buf)-1);
+        if (n < 0) { perror("read"); return -1; }
+#endif
+        if (n == 0) { fprintf(stderr, "server closed connection\n"); return -2; }
+        for (int i=0; i<(int)n; i++) {
+            if (at_bol) { status_line = isdigit((unsigned char)buf[i]); at_bol = 0; }
+            if (buf[i] != '\n') continue;
+            if (status_line) {
+                fwrite(buf, 1, (size_t)i + 1, stdout);
+                return 0;
+            }
+            at_bol = 1;
+        }
+        fwrite(buf, 1, (size_t)n, stdout);
+    }
 }
 
 // ----- CLI -----
@@ -298,16 +351,18 @@ static void usage(const char *prog) {
     fprintf(stderr,
         "Usage:\n"
         "  %s [-c cfgfile] [-T host:port] set key=value [key=value ...]\n"
-        "  %s [-c cfgfile] [-T host:port] COMMAND [ARGS...]\n"
-        "  %s [-c cfgfile] [-T host:port]\n"
+        "  %s [-c cfgfile] [-T host:port] [-b] COMMAND [ARGS...]\n"
+        "  %s [-c cfgfile] [-T host:port] [-b]\n"
+        "  -b  use the binary framing (PROTO binary)\n"
         "Config: %%APPDATA%%\\vim-cmd\\config\n",
         prog, prog, prog);
 #else
     fprintf(stderr,
         "Usage:\n"
         "  %s [-c cfgfile] [-S socket] [-T host:port] set key=value [key=value ...]\n"
-        "  %s [-c cfgfile] [-S socket] [-T host:port] COMMAND [ARGS...]\n"
-        "  %s [-c cfgfile] [-S socket] [-T host:port]\n"
+        "  %s [-c cfgfile] [-S socket] [-T host:port] [-b] COMMAND [ARGS...]\n"
+        "  %s [-c cfgfile] [-S socket] [-T host:port] [-b]\n"
+        "  -b  use the binary framing (PROTO binary)\n"
         "Config: $XDG_CONFIG_HOME/vim-cmd/config or ~/.config/vim-cmd/config\n",
         prog, prog, prog);
 #endif
@@ -362,16 +417,18 @@ int main(int argc, char **argv) {
     while (argi < argc) {
         if (!strcmp(argv[argi], "-c") && argi+1<argc) { cli_cfg = argv[argi+1]; argi+=2; continue; }
         if (!strcmp(argv[argi], "-T") && argi+1<argc) { cli_tcp = argv[argi+1]; argi+=2; continue; }
+        if (!strcmp(argv[argi], "-b")) { g_binary = true; argi++; continue; }
         if (!strcmp(argv[argi], "-h")) { usage(argv[0]); WSACleanup(); return 0; }
         break;
     }
 #else
     int opt;
-    while ((opt = getopt(argc, argv, "c:S:T:h")) != -1) {
+    while ((opt = getopt(argc, argv, "c:S:T:bh")) != -1) {
         switch (opt) {
             case 'c': cli_cfg = optarg; break;
             case 'S': cli_sock = optarg; break;
             case 'T': cli_tcp  = optarg; break;
+            case 'b': g_binary = true; break;
             case 'h': default: usage(argv[0]); return opt=='h'?0:1;
         }
     }
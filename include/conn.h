@@ -0,0 +1,102 @@
+// conn.h - per-connection buffers shared by the server I/O backends
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "protocol.h"
+
+#define IN_RING         4096           // per-connection input ring; also the max line length
+#define RESP_MAX        4096           // outbuf handed to protocol_handle / protocol_stream_next
+#define OUTBLK_SIZE     (16 * 1024)
+#define MAX_IOV         64
+#define OUT_HIGH_WATER  (256 * 1024)   // stop reading a client while this much is unsent
+#define DRAIN_MS        1000           // grace period for open clients after SHUTDOWN
+
+// Every fd a backend polls carries one of these as its first member.
+typedef enum { SRC_LISTENER = 1, SRC_CLIENT = 2, SRC_WAKE = 3 } src_kind_t;
+
+// The loop's eventfd, written by the journal after every commit.
+typedef struct {
+    src_kind_t  kind;
+    int         fd;
+} waker_t;
+
+typedef struct {
+    src_kind_t  kind;
+    int         fd;
+    const char *proto;      // "unix" / "tcp"
+    int         shared;     // one fd polled by every worker (EPOLLEXCLUSIVE)
+} listener_t;
+
+// Queued response bytes. Responses are formatted straight into the tail
+// block and the whole chain goes out with one writev().
+typedef struct outblk {
+    struct outblk *next;
+    size_t off;                 // bytes already sent
+    size_t len;                 // bytes filled
+    char   data[OUTBLK_SIZE];
+} outblk_t;
+
+typedef struct conn {
+    src_kind_t  kind;
+    int         fd;
+    const char *proto;
+    struct conn *prev, *next;   // loop's list of open connections
+    int         eof;        // peer closed its write side
+    int         dead;       // fatal error; close asap
+    int         rd_paused;  // output backlog above high water, reads deferred
+    int         discarding; // dropping the rest of an over-long line
+    uint32_t    iskip;      // binary: bytes of an oversized frame still to drop
+    uint32_t    ihead;      // input ring: next unconsumed byte (free-running)
+    uint32_t    itail;      // input ring: next byte to fill (free-running)
+    uint32_t    iscan;      // bytes past ihead already searched for '\n'
+    outblk_t   *ohead, *otail;
+    size_t      opending;   // unsent bytes across the chain
+    proto_session_t sess;   // a streaming reply holds back later lines
+    unsigned long long hold_lsn;    // journal change the queued replies wait on (0: none)
+    struct conn *hnext;     // loop's list of connections waiting on the journal
+    int         held;       // on that list
+
+    // io_uring backend only
+    int         inflight;   // SQEs submitted and not yet completed
+    int         recv_armed;
+    int         wr_inflight;
+    int         stash_bid;  // provided buffer not yet copied into the ring (-1: none)
+    uint32_t    stash_off, stash_len;
+    struct iovec wiov[MAX_IOV];
+
+    char        in[IN_RING];
+} conn_t;
+
+// Per-loop I/O accounting, logged when the loop exits.
+typedef struct {
+    uint64_t syscalls;      // I/O-path syscalls issued by the loop
+    uint64_t requests;      // protocol lines dispatched
+} io_counters_t;
+
+// Allocate/free a connection for an accepted fd.
+conn_t *conn_new(int fd, const char *proto);
+void conn_free(conn_t *c);
+
+// Output chain
+char *conn_out_reserve(conn_t *c, size_t need);
+void conn_out_commit(conn_t *c, size_t n);
+int  conn_queue(conn_t *c, const char *buf, size_t len);
+
+// Whether queued output may go out: not while it acknowledges a change the
+// journal has not synced yet. Marks the connection dead if the journal
+// failed, so the client sees a hangup rather than a false acknowledgement.
+int  conn_out_ready(conn_t *c);
+int  conn_out_iov(conn_t *c, struct iovec *iov, int max);
+void conn_out_consume(conn_t *c, size_t n);
+
+// Input ring: free space as up to two iovecs, and accounting for filled bytes.
+int  conn_in_iov(conn_t *c, struct iovec iov[2]);
+void conn_in_commit(conn_t *c, size_t n);
+
+// Continue any streaming reply, then run every complete line (or binary
+// frame, after PROTO binary) in the input ring; returns the number of requests dispatched. Sets rd_paused when the
+// output backlog is too big, which is also how a long stream waits for the
+// socket to drain.
+size_t conn_process_input(conn_t *c);
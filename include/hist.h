@@ -0,0 +1,31 @@
+// hist.h - log-linear latency histogram (HDR-style)
+#pragma once
+#include <stdint.h>
+
+// Every power of two is split into HIST_SUB equal buckets, so a value is
+// known to within 1/HIST_SUB (6.25%) of itself however large it is, with
+// a fixed, small table and no floating point on the record path. Values
+// below HIST_SUB get a bucket each; values at or past 2^HIST_MAX_BITS
+// share the last one (max still has them exactly).
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1u << HIST_SUB_BITS)
+#define HIST_MAX_BITS 36        // ns: about 69 s
+#define HIST_BUCKETS  ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t b[HIST_BUCKETS];
+} hist_t;
+
+// One writer per histogram; stores are relaxed atomics, so hist_merge may
+// read it from another thread at any time.
+void hist_record(hist_t *h, uint64_t v);
+
+// Add src into dst (dst private to the caller).
+void hist_merge(hist_t *dst, const hist_t *src);
+
+// Highest value of the bucket holding quantile q (0..1), capped at max.
+uint64_t hist_quantile(const hist_t *h, double q);
@@ -5,7 +5,11 @@
 
 extern volatile sig_atomic_t g_running;   // set false to stop server
 extern FILE *g_logfp;
-extern int g_verbose;
+
+// I/O backend used by server_run_listeners (-B). io_uring falls back to
+// epoll when it is not compiled in or the kernel lacks support.
+typedef enum { SERVER_BACKEND_EPOLL = 0, SERVER_BACKEND_URING = 1 } server_backend_t;
+extern server_backend_t g_backend;
 
 void log_init(const char *path, int foreground);
 void log_close(void);
@@ -16,3 +20,9 @@ int server_run(const char *sock_path);
 
 // NEW: TCP variant
 int server_run_tcp(const char *bind_host, int bind_port);
+
+// Serve a UNIX socket and/or a TCP port from one event loop per worker.
+// Pass sock_path=NULL or bind_port<=0 to skip that listener. With
+// nworkers > 1 each worker thread has its own SO_REUSEPORT TCP listener
+// and they share the UNIX socket's accept queue.
+int server_run_listeners(const char *sock_path, const char *bind_host, int bind_port, int nworkers);
@@ -0,0 +1,23 @@
+// intern.h - reference-counted string intern table
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Equal strings share one copy and one small integer ref. Not
+// thread-safe: callers serialize writers and keep readers out while a
+// writer runs (libvm_stub.c holds its registry lock).
+
+#define INTERN_NONE UINT32_MAX
+
+int  intern_init(void);
+void intern_shutdown(void);
+
+// Take a reference to `s` (len bytes, need not be NUL-terminated),
+// adding it if new. Returns INTERN_NONE on allocation failure.
+uint32_t intern_put(const char *s, size_t len);
+
+// Drop a reference; the string is freed when the last one goes.
+void intern_drop(uint32_t ref);
+
+const char *intern_str(uint32_t ref);
+size_t intern_len(uint32_t ref);
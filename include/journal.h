@@ -0,0 +1,107 @@
+// journal.h - on-disk form of the VM store: snapshot plus journal
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// A data directory holds one snapshot and the journal files written
+// since it was taken:
+//
+//   snapshot        the store's slot arrays as of generation G, laid out
+//                   so that loading is an mmap and a few memcpys
+//   journal.<n>     records appended after it, n = G, G+1, ...
+//
+// A journal record is a group of operations that stands or falls as a
+// whole (one create, or every change of an atomic BATCH):
+//
+//   u32 len | u32 crc32(payload) | payload[len]
+//   payload: ops of JOP_HDR bytes plus the name, see jop_encode
+//
+// Replay stops at the first record that is short or fails its checksum,
+// which is what a crash in the middle of an append leaves behind, and
+// truncates the file there. A snapshot is written to a temporary file,
+// synced and renamed into place, so it is either the old one or the new.
+// Integers are host byte order; the files are not meant to move between
+// machines.
+
+enum { JOP_CREATE = 1, JOP_DESTROY = 2 };
+
+typedef struct {
+    uint8_t     op;
+    uint8_t     state;          // vm_state_t (create)
+    uint8_t     name_len;
+    int32_t     id;
+    int32_t     mem_mib;
+    const char *name;           // not NUL-terminated (create)
+} jop_t;
+
+#define JOP_HDR 12
+#define JOP_MAX (JOP_HDR + 255)
+
+// Encode an op into dst (JOP_MAX bytes); returns its length.
+size_t jop_encode(char *dst, const jop_t *op);
+
+// The snapshot's slot arrays, one entry per slot, free slots included.
+// From journal_map_snapshot these point into the mapping; for
+// journal_write_snapshot the caller fills them in.
+typedef struct {
+    uint64_t        gen;        // first journal generation not folded in
+    uint64_t        nslots;
+    uint64_t        nlive;
+    const int32_t  *id;
+    const int32_t  *mem_mib;
+    const uint8_t  *state;
+    const uint32_t *name_off;   // into names: u8 len | bytes
+    const char     *names;
+    uint64_t        names_len;
+} jsnap_t;
+
+// Use dir (created if missing) for the files below. 0 or -1.
+// journal_close drains the queue, stops the writer and closes the files.
+int  journal_open(const char *dir);
+void journal_close(void);
+
+// Map the snapshot. 1 when there is one, 0 when there is none (gen 0),
+// -1 when it is unreadable. journal_unmap_snapshot releases the mapping.
+int  journal_map_snapshot(jsnap_t *snap);
+void journal_unmap_snapshot(jsnap_t *snap);
+
+// Feed every op journaled since generation gen to fn, oldest first, and
+// leave the newest journal open for appending. Returns the number of ops
+// applied, or -1 when a journal cannot be read or fn fails.
+long journal_replay(uint64_t gen, int (*fn)(const jop_t *op, void *arg), void *arg);
+
+// Start the group-commit writer. Records appended while a commit is in
+// flight, or within commit_window_us of the first one, go out with one
+// write and one fdatasync. 0 or -1.
+int  journal_start(unsigned commit_window_us);
+
+// Queue one record made of nops concatenated encoded ops. Returns its
+// sequence number (1, 2, ...), or 0 when the journal has failed. The
+// record is durable once journal_synced says so.
+uint64_t journal_append(const char *buf, size_t len, size_t nops);
+
+// 1 once record lsn is on disk, 0 while it is queued or being written,
+// -1 if it never will be (a write or sync failed).
+int  journal_synced(uint64_t lsn);
+
+// Wait until everything appended so far is durable. 0 or -1.
+int  journal_flush(void);
+
+// Write to eventfd fd (on=1) after every commit, or stop (on=0).
+int  journal_notify(int fd, int on);
+
+// Ops appended since the last rotation.
+uint64_t journal_ops(void);
+
+// Flush, then start a new journal generation and return it; later appends
+// go there. The caller holds the store still, so the snapshot it takes
+// next covers exactly the generations before the returned one.
+int  journal_rotate(uint64_t *gen);
+
+// Write snap (snap->gen from journal_rotate) and delete the journals it
+// makes redundant.
+int  journal_write_snapshot(const jsnap_t *snap);
+
+// Commit counters and histograms (libvm.h).
+struct vm_persist_stats;
+void journal_stats(struct vm_persist_stats *out);
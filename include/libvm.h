@@ -5,13 +5,25 @@
 extern "C" {
 #endif
 
+typedef enum {
+    VM_STATE_STOPPED = 0,
+    VM_STATE_RUNNING,
+    VM_STATE_PAUSED,
+    VM_STATE_COUNT
+} vm_state_t;
+
+// Public record. The store keeps a compact internal form (enum state,
+// interned name, hot fields in separate arrays) and converts on the way out.
 typedef struct {
     int   id;
     char  name[64];
     int   mem_mib;
     char  state[16]; // "stopped", "running", etc.
+    vm_state_t state_code;
 } vm_t;
 
+const char *vm_state_name(vm_state_t s);
+
 // Initialize/shutdown VM subsystem (stub impl here)
 int vm_init(void);
 int vm_shutdown(void);
@@ -19,11 +31,68 @@ int vm_shutdown(void);
 // List VMs. If out==NULL, only count is returned in *count.
 int vm_list(vm_t *out, size_t max, size_t *count);
 
-// Create/destroy/info
+// Resumable walk in slot order. *cursor is 0 to start and is advanced past
+// the up to `max` VMs copied into out (*got of them). Returns 1 while more
+// VMs follow the cursor, 0 at the end of the table.
+int vm_list_from(size_t *cursor, vm_t *out, size_t max, size_t *got);
+
+// Create/destroy/info. Ids are opaque generational handles: once a VM is
+// destroyed its id is rejected, even after the slot is reused.
 int vm_create(const char *name, int mem_mib, int *out_id);
 int vm_destroy(int id);
 int vm_info(int id, vm_t *out);
 
+// Total memory and VM count per state in one pass over the hot arrays.
+// Either output may be NULL.
+int vm_mem_by_state(long long mem_out[VM_STATE_COUNT], size_t count_out[VM_STATE_COUNT]);
+
+// Persistence. vm_persist_open loads the store from dir (snapshot plus
+// journal tail) and journals every later create and destroy there; call it
+// once, right after vm_init. From then on a mutation that cannot be
+// journaled fails. vm_persist_compact folds the journal into a new
+// snapshot; a background thread also does so once the journal outgrows the
+// store, and vm_shutdown does it a last time. Returns 0 or -1.
+//
+// Journal writes are group-committed: a change is visible at once but
+// durable only when its commit (one write, one fdatasync) completes.
+// Commits start as soon as the previous one ends, or commit_window_us
+// after the first change waiting for one, trading latency for batch size.
+int vm_persist_open(const char *dir, unsigned commit_window_us);
+int vm_persist_compact(void);
+
+// Sequence number of the last change the calling thread made, 0 if none.
+unsigned long long vm_persist_last(void);
+
+// 1 once change `seq` is durable, 0 while it is not yet, -1 if it never
+// will be (the journal failed). Always 1 without persistence.
+int vm_persist_synced(unsigned long long seq);
+
+// Have the journal write to eventfd fd after every commit (on=1), or
+// stop (on=0). -1 without persistence.
+int vm_persist_notify(int fd, int on);
+
+typedef struct vm_persist_stats {
+    unsigned long long commits;         // fdatasyncs
+    unsigned long long records;         // changes (a BATCH is one)
+    unsigned long long bytes;
+    unsigned long long pending;         // changes not durable yet
+    unsigned long long batch_p50, batch_p99, batch_max;        // records per commit
+    unsigned long long fsync_p50_ns, fsync_p99_ns, fsync_max_ns, fsync_sum_ns;
+    int failed;
+} vm_persist_stats_t;
+
+// -1 without persistence.
+int vm_persist_stats(vm_persist_stats_t *out);
+
+// Run a group of calls as one unit. From begin to end the calling thread
+// holds the store exclusively (other threads see all of the group or none
+// of it) and makes its vm_* calls as usual. vm_batch_end(0) rolls back
+// every create and destroy since begin; vm_batch_end(1) keeps them.
+// Batches do not nest. Returns 0, or -1 when misused or when a commit
+// could not be journaled (it is rolled back then).
+int vm_batch_begin(void);
+int vm_batch_end(int commit);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,8 +1,68 @@
 #pragma once
 #include <stdio.h>
 
+// What a producer does when the async ring is full.
+typedef enum {
+    LOG_FULL_DROP = 0,      // discard the message; the flusher reports how many
+    LOG_FULL_BLOCK,         // wait for the flusher to make room
+} log_full_t;
+
 void log_init(const char *path, int foreground);
 void log_close(void);
 void log_msg(const char *fmt, ...);
 
+// Hand log_msg over to a background flusher thread. Call after log_init
+// (and after daemonizing); log_close drains and stops it.
+int log_start_async(log_full_t policy);
+
 extern FILE *g_logfp;
+
+// ----- levels and subsystems -----
+// LOGE..LOGT(sys, fmt, ...) log at one level for one subsystem. A level
+// above LOG_COMPILE_LEVEL is dead code the compiler drops; otherwise the
+// subsystem's runtime level is checked before any argument is formatted.
+
+#define LOG_LVL_ERROR 0
+#define LOG_LVL_WARN  1
+#define LOG_LVL_INFO  2
+#define LOG_LVL_DEBUG 3
+#define LOG_LVL_TRACE 4
+#define LOG_NLEVELS   5
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LVL_TRACE     // make LOG_LEVEL=n to strip more
+#endif
+
+typedef enum {
+    LOG_SYS_SERVER = 0,
+    LOG_SYS_PROTOCOL,
+    LOG_SYS_LIBVM,
+    LOG_NSYS
+} log_sys_t;
+
+extern unsigned char g_log_level[LOG_NSYS];     // runtime level per subsystem
+
+#define LOG_ENABLED(sys, lvl) \
+    ((lvl) <= LOG_COMPILE_LEVEL && (lvl) <= __atomic_load_n(&g_log_level[sys], __ATOMIC_RELAXED))
+
+#define LOG_AT(sys, lvl, ...) \
+    do { if (LOG_ENABLED(sys, lvl)) log_write(sys, lvl, __VA_ARGS__); } while (0)
+
+#define LOGE(sys, ...) LOG_AT(sys, LOG_LVL_ERROR, __VA_ARGS__)
+#define LOGW(sys, ...) LOG_AT(sys, LOG_LVL_WARN,  __VA_ARGS__)
+#define LOGI(sys, ...) LOG_AT(sys, LOG_LVL_INFO,  __VA_ARGS__)
+#define LOGD(sys, ...) LOG_AT(sys, LOG_LVL_DEBUG, __VA_ARGS__)
+#define LOGT(sys, ...) LOG_AT(sys, LOG_LVL_TRACE, __VA_ARGS__)
+
+// Unconditional; callers go through the macros above.
+void log_write(log_sys_t sys, int level, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+// Set one subsystem's level, or every subsystem's with sys < 0.
+void log_set_level(int sys, int level);
+
+// Names used by -v, LOG.LEVEL and the line prefix; lookups return -1
+// for an unknown name.
+const char *log_level_name(int level);
+const char *log_sys_name(int sys);
+int log_level_parse(const char *s, size_t len);
+int log_sys_parse(const char *s, size_t len);
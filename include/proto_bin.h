@@ -0,0 +1,53 @@
+// proto_bin.h - wire format of the binary framing ("PROTO binary")
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// A client switches a connection over by sending the text line
+// "PROTO binary"; the "200 OK binary" answer is the last text on it.
+// From then on both directions carry frames, integers little-endian:
+//
+//   u32 len | payload[len]
+//
+// Request payload: the verb and its arguments as raw byte strings, so
+// values need no quoting and may hold anything, newlines included.
+//
+//   u8 verb_len | verb | u8 nargs | nargs x (u8 key_len | key | u16 val_len | val)
+//
+// key_len 0 is a positional value. Response payload:
+//
+//   u8 status (PB_OK/PB_ERR) | u8 type | body
+//
+// "PROTO text" switches back; its answer is the last frame.
+
+#define PB_MAX_FRAME 4092   // payload bytes; a frame and its prefix fit the input ring
+
+#define PB_OK   0
+#define PB_ERR  1
+
+#define PB_T_MSG 0  // text: what follows "200 OK " / "400 ERR " in text mode
+#define PB_T_ID  1  // i32 id (VM.CREATE)
+#define PB_T_VM  2  // one VM record (VM.INFO)
+#define PB_T_VMS 3  // u16 count | count records; VM.LIST sends these until PB_T_END
+#define PB_T_END 4  // u32 count | u32 next cursor (0: end of table); closes a VM.LIST
+#define PB_T_TAG 5  // u32 index; the frames up to the next TAG answer that BATCH command
+#define PB_T_LINE 6 // text: one line of a multi-line reply (STATS); a PB_T_MSG closes it
+
+// VM record, PB_VM_SIZE bytes:
+//   0 i32 id | 4 i32 mem_mib | 8 u8 state (vm_state_t) | 9 u8 name_len | 10 name[64]
+#define PB_VM_NAME 64
+#define PB_VM_SIZE (10 + PB_VM_NAME)
+
+static inline void pb_put16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8);
+}
+static inline void pb_put32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;         p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24);
+}
+static inline uint16_t pb_get16(const unsigned char *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+static inline uint32_t pb_get32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
@@ -3,4 +3,88 @@
 
 // Parse a single line command and write a one-line response into outbuf.
 // Returns number of bytes written (excluding terminating NUL), or -1 on error.
+// A reply too long for outbuf is cut short; servers use protocol_handle.
 int protocol_handle_line(const char *line, char *outbuf, size_t outsz);
+
+// ----- sessions -----
+// Per-connection protocol state. A command whose reply does not fit in one
+// outbuf (VM.LIST) writes the first part and leaves a stream behind; the
+// server pulls the rest with protocol_stream_next as the socket drains and
+// runs no further commands on that connection until the stream ends.
+
+typedef struct proto_stream proto_stream_t;
+typedef struct proto_batch proto_batch_t;
+
+typedef struct {
+    proto_stream_t *stream;     // unfinished reply, or NULL
+    proto_batch_t  *batch;      // BATCH collecting its commands, or NULL
+    int binary;                 // framing after "PROTO binary" (proto_bin.h)
+    int failed;                 // last reply was an error
+    int in_batch;               // running a batch's commands
+} proto_session_t;
+
+// Like protocol_handle_line, but may leave s->stream set.
+int protocol_handle(proto_session_t *s, const char *line, char *outbuf, size_t outsz);
+
+// The same for one binary request frame (payload only, prefix stripped);
+// replies are frames too.
+int protocol_handle_frame(proto_session_t *s, const char *frame, size_t len, char *outbuf, size_t outsz);
+
+// An error reply in the session's framing, for faults found outside a
+// command (an oversized frame).
+int protocol_error(proto_session_t *s, char *outbuf, size_t outsz, const char *msg);
+
+// Write the next part of the pending reply into outbuf (outsz must be at
+// least PROTO_STREAM_MIN); clears s->stream after the last part. Returns
+// the number of bytes written.
+#define PROTO_STREAM_MIN 512
+int protocol_stream_next(proto_session_t *s, char *outbuf, size_t outsz);
+
+// Drop any pending reply or unfinished batch (connection closing).
+void protocol_session_end(proto_session_t *s);
+
+// ----- request tokenizer -----
+// A request is "VERB arg arg ..." where each arg is key=value or a bare
+// positional value. Values may be double-quoted to include blanks; inside
+// quotes \" and \\ escape a quote and a backslash. Spans point into the
+// tokenized line; nothing is copied.
+
+#define PROTO_MAX_ARGS 16
+
+typedef struct {
+    const char *p;
+    size_t      len;
+} proto_span_t;
+
+typedef struct {
+    proto_span_t key;       // len 0 for a positional arg
+    proto_span_t val;       // quotes excluded
+    int          escaped;   // val contains backslash escapes
+} proto_kv_t;
+
+typedef struct {
+    proto_span_t verb;
+    proto_span_t rest;      // everything after the verb
+    proto_kv_t   kv[PROTO_MAX_ARGS];
+    size_t       nkv;
+} proto_req_t;
+
+// Returns 0, or -1 on an unterminated quote or too many args.
+int proto_tokenize(const char *line, size_t len, proto_req_t *req);
+
+// First arg with this key, or NULL.
+const proto_kv_t *proto_arg(const proto_req_t *req, const char *key);
+
+// Per-command counters, one row per registered verb plus "(unknown)",
+// summed over every thread's stats shard (stats.h).
+typedef struct {
+    const char *verb;
+    unsigned long long calls;
+    unsigned long long errors;
+    unsigned long long bytes_in, bytes_out;
+    unsigned long long lat_sum_ns;          // dispatch time; p* are within 6.25%
+    unsigned long long p50_ns, p90_ns, p99_ns, p999_ns, max_ns;
+} protocol_cmd_stat_t;
+
+// Copy up to max rows into out; returns the number written.
+size_t protocol_command_stats(protocol_cmd_stat_t *out, size_t max);
@@ -0,0 +1,12 @@
+// server_uring.h - io_uring backend for the server loop (Linux, optional)
+#pragma once
+#include <stddef.h>
+
+#include "conn.h"
+
+// Nonzero if the running kernel has every io_uring feature the backend
+// uses (multishot accept, provided buffer rings, writev).
+int uring_supported(void);
+
+// Serve the listeners until g_running drops; same contract as the epoll loop.
+int uring_loop(listener_t *ls, size_t nls, io_counters_t *ctr);
@@ -0,0 +1,45 @@
+// stats.h - server and per-command counters
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hist.h"
+
+// Every thread that records anything gets its own shard on first use and
+// is the only writer to it, so the hot path takes no lock and no locked
+// instruction. Readers add the shards up; a total may be a few updates
+// behind, never torn. Shards outlive their thread so totals never drop.
+
+#define STATS_MAX_CMDS 32       // protocol.c: one slot per command table row + unknown
+
+typedef struct {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t bytes_in;          // request line or frame payload
+    uint64_t bytes_out;         // reply, streamed parts included
+    hist_t   lat;               // dispatch time, ns
+} stats_cmd_t;
+
+typedef struct {
+    uint64_t accepts;
+    uint64_t closes;
+    uint64_t bytes_in;          // read from client sockets
+    uint64_t bytes_out;         // written to client sockets
+} stats_io_t;
+
+void stats_init(void);          // marks the start of uptime
+
+uint64_t stats_now_ns(void);    // CLOCK_MONOTONIC
+double   stats_uptime(void);    // seconds since stats_init
+
+void stats_cmd(size_t slot, int failed, size_t in, size_t out, uint64_t ns);
+void stats_cmd_out(size_t slot, size_t out);
+
+void stats_accept(void);
+void stats_close(void);
+void stats_read(size_t n);
+void stats_write(size_t n);
+
+// Totals over every shard.
+void stats_sum_cmd(size_t slot, stats_cmd_t *out);
+void stats_sum_io(stats_io_t *out);
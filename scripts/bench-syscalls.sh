@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+# Compare I/O syscalls per request across server backends.
+# Each worker logs "requests=R syscalls=S (X per request)" on exit.
+#   usage: scripts/bench-syscalls.sh [requests] [port]
+set -euo pipefail
+n="${1:-20000}"
+port="${2:-9190}"
+log=/tmp/hostd-bench-syscalls.log
+
+run() {
+    local backend="$1" mode="$2"
+    : > "$log"
+    ./hostd -f -B "$backend" -T "127.0.0.1:$port" -l "$log" 2>>"$log" &
+    local pid=$!
+    sleep 0.2
+
+    exec 3<>"/dev/tcp/127.0.0.1/$port"
+    if [ "$mode" = pipelined ]; then
+        # every request written before reading the replies
+        for ((i=0;i<n;i++)); do echo "PING"; done >&3
+        for ((i=0;i<n;i++)); do read -r _ <&3; done
+    else
+        # strict request/response
+        for ((i=0;i<n;i++)); do echo "PING" >&3; read -r _ <&3; done
+    fi
+    exec 3<&-
+
+    ./vim-cmd -T "127.0.0.1:$port" SHUTDOWN >/dev/null
+    wait "$pid" || true
+    local line
+    line=$(grep -o 'worker 0 ([a-z_]*): .*' "$log" | tail -n1)
+    printf '%-10s %s\n' "$mode" "${line#worker 0 }"
+}
+
+echo "requests per run: $n"
+for mode in pingpong pipelined; do
+    run epoll "$mode"
+    run uring "$mode"
+done
@@ -0,0 +1,270 @@
+// conn.c - per-connection input framing and output queueing
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "conn.h"
+#include "libvm.h"
+#include "protocol.h"
+#include "proto_bin.h"
+
+conn_t *conn_new(int fd, const char *proto) {
+    conn_t *c = malloc(sizeof(*c));
+    if (!c) return NULL;
+    memset(c, 0, offsetof(conn_t, in));   // the input ring needs no clearing
+    c->kind = SRC_CLIENT;
+    c->fd = fd;
+    c->proto = proto;
+    c->stash_bid = -1;
+    return c;
+}
+
+void conn_free(conn_t *c) {
+    protocol_session_end(&c->sess);
+    while (c->ohead) {
+        outblk_t *b = c->ohead;
+        c->ohead = b->next;
+        free(b);
+    }
+    free(c);
+}
+
+// ----- output chain -----
+
+// Return a pointer to at least `need` contiguous free bytes at the tail.
+char *conn_out_reserve(conn_t *c, size_t need) {
+    if (c->otail && OUTBLK_SIZE - c->otail->len >= need) return c->otail->data + c->otail->len;
+    outblk_t *b = malloc(sizeof(*b));
+    if (!b) return NULL;
+    b->next = NULL;
+    b->off = b->len = 0;
+    if (c->otail) c->otail->next = b; else c->ohead = b;
+    c->otail = b;
+    return b->data;
+}
+
+void conn_out_commit(conn_t *c, size_t n) {
+    c->otail->len += n;
+    c->opending += n;
+}
+
+int conn_queue(conn_t *c, const char *buf, size_t len) {
+    while (len > 0) {
+        size_t room = c->otail ? OUTBLK_SIZE - c->otail->len : 0;
+        if (room == 0) {
+            if (!conn_out_reserve(c, OUTBLK_SIZE)) return -1;
+            room = OUTBLK_SIZE;
+        }
+        size_t k = len < room ? len : room;
+        memcpy(c->otail->data + c->otail->len, buf, k);
+        conn_out_commit(c, k);
+        buf += k;
+        len -= k;
+    }
+    return 0;
+}
+
+int conn_out_ready(conn_t *c) {
+    if (!c->hold_lsn) return 1;
+    int st = vm_persist_synced(c->hold_lsn);
+    if (st < 0) c->dead = 1;
+    if (st <= 0) return 0;
+    c->hold_lsn = 0;
+    return 1;
+}
+
+// A request that changed the store holds back every reply queued so far,
+// its own included, until the journal has synced the change.
+static void conn_note_change(conn_t *c, unsigned long long before) {
+    unsigned long long lsn = vm_persist_last();
+    if (lsn != before) c->hold_lsn = lsn;
+}
+
+// Describe the unsent bytes as at most `max` iovecs.
+int conn_out_iov(conn_t *c, struct iovec *iov, int max) {
+    int cnt = 0;
+    for (outblk_t *b = c->ohead; b && cnt < max; b = b->next) {
+        if (b->len == b->off) continue;
+        iov[cnt].iov_base = b->data + b->off;
+        iov[cnt].iov_len  = b->len - b->off;
+        cnt++;
+    }
+    return cnt;
+}
+
+// Drop `n` sent bytes from the front of the chain.
+void conn_out_consume(conn_t *c, size_t n) {
+    c->opending -= n;
+    while (c->ohead) {
+        outblk_t *b = c->ohead;
+        size_t k = b->len - b->off;
+        if (n < k) { b->off += n; break; }
+        n -= k;
+        if (b == c->otail) { b->off = b->len = 0; break; }   // keep one block around
+        c->ohead = b->next;
+        free(b);
+    }
+}
+
+// ----- input ring -----
+
+int conn_in_iov(conn_t *c, struct iovec iov[2]) {
+    uint32_t used = c->itail - c->ihead;
+    uint32_t off  = c->itail & (IN_RING-1);
+    uint32_t room = IN_RING - used;
+    if (room == 0) return 0;
+    iov[0].iov_base = c->in + off;
+    iov[0].iov_len  = room < IN_RING - off ? room : IN_RING - off;
+    if (iov[0].iov_len == room) return 1;
+    iov[1].iov_base = c->in;
+    iov[1].iov_len  = room - iov[0].iov_len;
+    return 2;
+}
+
+void conn_in_commit(conn_t *c, size_t n) { c->itail += (uint32_t)n; }
+
+static void conn_dispatch_line(conn_t *c, char *line, size_t len) {
+    if (len > 0 && line[len-1] == '\r') line[--len] = 0;
+    if (len == 0) return;
+
+    char *dst = conn_out_reserve(c, RESP_MAX);
+    if (!dst) { c->dead = 1; return; }
+    unsigned long long lsn = vm_persist_last();
+    int wr = protocol_handle(&c->sess, line, dst, RESP_MAX);
+    conn_note_change(c, lsn);
+    if (wr < 0) {
+        const char *err = "400 ERR internal\n";
+        if (conn_queue(c, err, strlen(err)) != 0) c->dead = 1;
+        return;
+    }
+    if ((size_t)wr >= RESP_MAX) {   // truncated: keep the line framing intact
+        wr = RESP_MAX - 1;
+        dst[wr-1] = '\n';
+    }
+    conn_out_commit(c, (size_t)wr);
+}
+
+// Copy n ring bytes starting at free-running position pos.
+static void ring_copy(const conn_t *c, uint32_t pos, char *dst, uint32_t n) {
+    uint32_t off = pos & (IN_RING-1);
+    uint32_t first = IN_RING - off;
+    if (first > n) first = n;
+    memcpy(dst, c->in + off, first);
+    memcpy(dst + first, c->in, n - first);
+}
+
+// Run the next complete binary frame, in place when contiguous. Returns 0
+// when more input is needed.
+static int conn_next_frame(conn_t *c, char *scratch) {
+    uint32_t used = c->itail - c->ihead;
+    if (c->iskip) {
+        uint32_t k = c->iskip < used ? c->iskip : used;
+        c->ihead += k;
+        c->iskip -= k;
+        return k > 0;
+    }
+    if (used < 4) return 0;
+    unsigned char hdr[4];
+    ring_copy(c, c->ihead, (char *)hdr, 4);
+    uint32_t len = pb_get32(hdr);
+
+    char *dst = conn_out_reserve(c, RESP_MAX);
+    if (!dst) { c->dead = 1; return 0; }
+    if (len > PB_MAX_FRAME) {
+        // cannot fit the ring; answer and skip it so the stream stays in sync
+        conn_out_commit(c, (size_t)protocol_error(&c->sess, dst, RESP_MAX, "frame too large"));
+        c->ihead += 4;
+        c->iskip = len;
+        return 1;
+    }
+    if (used - 4 < len) return 0;
+
+    uint32_t off = (c->ihead + 4) & (IN_RING-1);
+    char *frame = c->in + off;
+    if (off + len > IN_RING) {
+        ring_copy(c, c->ihead + 4, scratch, len);
+        frame = scratch;
+    }
+    c->ihead += 4 + len;
+    unsigned long long lsn = vm_persist_last();
+    int wr = protocol_handle_frame(&c->sess, frame, len, dst, RESP_MAX);
+    conn_note_change(c, lsn);
+    if (wr < 0) wr = protocol_error(&c->sess, dst, RESP_MAX, "internal");
+    conn_out_commit(c, (size_t)wr);
+    return 1;
+}
+
+// Next part of a streaming reply, formatted straight into the tail block.
+static void conn_stream(conn_t *c) {
+    char *dst = conn_out_reserve(c, RESP_MAX);
+    if (!dst) { c->dead = 1; return; }
+    conn_out_commit(c, (size_t)protocol_stream_next(&c->sess, dst, RESP_MAX));
+}
+
+// Position of the next '\n' in the ring, continuing where the last search
+// stopped so a slowly arriving line is not rescanned on every read.
+static int ring_find_nl(conn_t *c, uint32_t *pos) {
+    uint32_t p = c->ihead + c->iscan;
+    while (p != c->itail) {
+        uint32_t off = p & (IN_RING-1);
+        uint32_t seg = IN_RING - off;
+        if (seg > c->itail - p) seg = c->itail - p;
+        char *hit = memchr(c->in + off, '\n', seg);
+        if (hit) { *pos = p + (uint32_t)(hit - (c->in + off)); return 1; }
+        p += seg;
+    }
+    c->iscan = c->itail - c->ihead;
+    return 0;
+}
+
+// Lines are handed to the protocol in place when contiguous; only a line
+// that wraps the ring is copied out.
+size_t conn_process_input(conn_t *c) {
+    char scratch[IN_RING + 1];
+    size_t nreq = 0;
+    while (!c->dead) {
+        if (c->opending >= OUT_HIGH_WATER) { c->rd_paused = 1; break; }
+        if (c->sess.stream) { conn_stream(c); continue; }
+        if (c->sess.binary) {
+            if (!conn_next_frame(c, scratch)) break;
+            nreq++;
+            continue;
+        }
+
+        uint32_t nl;
+        int found = ring_find_nl(c, &nl);
+        uint32_t used = c->itail - c->ihead;
+        if (!found) {
+            if (used == IN_RING && !c->discarding) {
+                const char *err = "400 ERR line too long\n";
+                if (conn_queue(c, err, strlen(err)) != 0) c->dead = 1;
+                c->discarding = 1;
+            }
+            if (c->discarding) {
+                c->ihead = c->itail;
+                c->iscan = 0;
+                break;
+            }
+            if (!c->eof || used == 0) break;
+            nl = c->itail;          // unterminated last line before EOF
+        }
+
+        uint32_t len = nl - c->ihead;
+        uint32_t off = c->ihead & (IN_RING-1);
+        char *line;
+        if (off + len < IN_RING) {
+            line = c->in + off;     // '\n' (or free space) follows in place
+        } else {
+            ring_copy(c, c->ihead, scratch, len);
+            line = scratch;
+        }
+        line[len] = 0;
+        c->ihead = found ? nl + 1 : nl;
+        c->iscan = 0;
+
+        if (c->discarding) { c->discarding = 0; continue; }
+        conn_dispatch_line(c, line, len);
+        nreq++;
+    }
+    return nreq;
+}
@@ -0,0 +1,57 @@
+// hist.c - log-linear latency histogram (HDR-style)
+#include "hist.h"
+
+static unsigned bucket_of(uint64_t v) {
+    if (v < HIST_SUB) return (unsigned)v;
+    if (v >> HIST_MAX_BITS) return HIST_BUCKETS - 1;
+    unsigned msb = 63u - (unsigned)__builtin_clzll(v);
+    unsigned shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (unsigned)((v >> shift) & (HIST_SUB - 1));
+}
+
+static uint64_t bucket_top(unsigned i) {
+    if (i < HIST_SUB) return i;
+    unsigned shift = i / HIST_SUB - 1;
+    uint64_t lo = (uint64_t)(HIST_SUB + i % HIST_SUB) << shift;
+    return lo + ((uint64_t)1 << shift) - 1;
+}
+
+// Single writer: a relaxed load/store pair instead of a locked add.
+static inline void bump(uint64_t *p, uint64_t d) {
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + d, __ATOMIC_RELAXED);
+}
+
+void hist_record(hist_t *h, uint64_t v) {
+    bump(&h->b[bucket_of(v)], 1);
+    bump(&h->count, 1);
+    bump(&h->sum, v);
+    if (v > h->max) __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+    for (unsigned i=0;i<HIST_BUCKETS;i++) dst->b[i] += __atomic_load_n(&src->b[i], __ATOMIC_RELAXED);
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    uint64_t m = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (m > dst->max) dst->max = m;
+}
+
+uint64_t hist_quantile(const hist_t *h, double q) {
+    // count is bumped after the bucket; sum the buckets so a concurrent
+    // writer cannot leave the rank past the last one
+    uint64_t total = 0;
+    for (unsigned i=0;i<HIST_BUCKETS;i++) total += h->b[i];
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+    uint64_t seen = 0;
+    for (unsigned i=0;i<HIST_BUCKETS;i++) {
+        seen += h->b[i];
+        if (seen >= rank) {
+            uint64_t top = bucket_top(i);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
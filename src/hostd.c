@@ -11,10 +11,11 @@
 #include "log.h"
 #include "daemonize.h"
 #include "libvm.h"
+#include "stats.h"
 #include "version.h"
 
 volatile sig_atomic_t g_running = 1;
-int g_verbose = 0;
+server_backend_t g_backend = SERVER_BACKEND_EPOLL;
 
 static const char *DEFAULT_SOCK = "/tmp/hostd.sock";
 static const char *DEFAULT_LOG  = "/tmp/hostd.log";
@@ -25,13 +26,22 @@ static void on_signal(int sig) { (void)sig; g_running = 0; }
 static void usage(const char *prog) {
     fprintf(stderr,
         "hostd (strawman) " HOSTD_VERSION "\n"
-        "Usage: %s [-f] [-S socket] [-T host:port] [-l logfile] [-p pidfile] [-v] [-V]\n"
+        "Usage: %s [-f] [-S socket] [-T host:port] [-w workers] [-B backend] [-l logfile] [-d datadir [-g usec]] [-a drop|block] [-p pidfile] [-v] [-V]\n"
         "  -f             Run in foreground (do not daemonize)\n"
         "  -S <socket>    UNIX socket path (default: %s)\n"
-        "  -T <host:port> Listen on TCP instead of UNIX socket\n"
+        "  -T <host:port> Listen on TCP instead of UNIX socket (both if -S is also given)\n"
+        "  -w <n>         Worker threads, each with its own event loop (default: 1)\n"
+        "  -B <backend>   I/O backend: epoll or uring (default: epoll)\n"
         "  -l <logfile>   Log file path (default: %s)\n"
+        "  -d <datadir>   Keep the VM inventory in this directory (snapshot plus\n"
+        "                 journal) and restore it at startup; default: memory only\n"
+        "  -g <usec>      Hold each journal commit open this long so more changes\n"
+        "                 share its fdatasync (default: 0, commit as soon as the\n"
+        "                 previous one is done)\n"
+        "  -a <policy>    Log from a background thread; when its buffer is full,\n"
+        "                 drop (and count) or block new messages\n"
         "  -p <pidfile>   Write PID to this file when daemonized\n"
-        "  -v             Verbose logging to stderr (foreground only)\n"
+        "  -v             Debug logging for every subsystem (-vv: trace)\n"
         "  -V             Show version and exit\n",
         prog, DEFAULT_SOCK, DEFAULT_LOG);
 }
@@ -40,18 +50,40 @@ int main(int argc, char **argv) {
     const char *sock_path = DEFAULT_SOCK;
     const char *log_path  = DEFAULT_LOG;
     const char *pid_path  = DEFAULT_PID;
+    const char *data_dir  = NULL;
+    unsigned commit_window_us = 0;
+    char data_abs[4096];
     int foreground = 0;
+    int sock_set = 0;
+    int workers = 1;
+    int verbose = 0;
+    int log_async = 0;
+    log_full_t log_policy = LOG_FULL_DROP;
 
     // NEW: TCP config (optional)
     char tcp_host[128] = {0};
     int  tcp_port = 0;
 
     int opt;
-    while ((opt = getopt(argc, argv, "fS:l:p:T:vVh")) != -1) {
+    while ((opt = getopt(argc, argv, "fS:l:d:g:a:p:T:w:B:vVh")) != -1) {
         switch (opt) {
             case 'f': foreground = 1; break;
-            case 'S': sock_path = optarg; break;
+            case 'S': sock_path = optarg; sock_set = 1; break;
             case 'l': log_path  = optarg; break;
+            case 'd': data_dir  = optarg; break;
+            case 'g': {
+                char *end;
+                long v = strtol(optarg, &end, 10);
+                if (*end || v < 0 || v > 1000000) { fprintf(stderr, "-g expects 0..1000000 (usec)\n"); return 1; }
+                commit_window_us = (unsigned)v;
+                break;
+            }
+            case 'a':
+                if (strcmp(optarg, "drop") == 0) log_policy = LOG_FULL_DROP;
+                else if (strcmp(optarg, "block") == 0) log_policy = LOG_FULL_BLOCK;
+                else { fprintf(stderr, "-a expects drop or block\n"); return 1; }
+                log_async = 1;
+                break;
             case 'p': pid_path  = optarg; break;
             case 'T': {
                 // parse host:port
@@ -65,18 +97,37 @@ int main(int argc, char **argv) {
                 if (tcp_port <= 0 || tcp_port > 65535) { fprintf(stderr, "invalid port\n"); return 1; }
                 break;
             }
-            case 'v': g_verbose++; break;
+            case 'w':
+                workers = atoi(optarg);
+                if (workers < 1 || workers > 256) { fprintf(stderr, "-w expects 1..256\n"); return 1; }
+                break;
+            case 'B':
+                if (strcmp(optarg, "epoll") == 0) g_backend = SERVER_BACKEND_EPOLL;
+                else if (strcmp(optarg, "uring") == 0) g_backend = SERVER_BACKEND_URING;
+                else { fprintf(stderr, "-B expects epoll or uring\n"); return 1; }
+                break;
+            case 'v': verbose++; break;
             case 'V': printf("hostd " HOSTD_VERSION "\n"); return 0;
             case 'h': default: usage(argv[0]); return opt=='h'?0:1;
         }
     }
 
+    if (verbose) log_set_level(-1, LOG_LVL_INFO + verbose);
+
     struct sigaction sa = {0};
     sa.sa_handler = on_signal;
     sigemptyset(&sa.sa_mask);
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
 
+    // daemonize() moves to /, so pin a relative data dir first
+    if (data_dir && data_dir[0] != '/') {
+        char cwd[2048];
+        if (!getcwd(cwd, sizeof(cwd))) { fprintf(stderr, "getcwd: %s\n", strerror(errno)); return 1; }
+        snprintf(data_abs, sizeof(data_abs), "%s/%s", cwd, data_dir);
+        data_dir = data_abs;
+    }
+
     if (!foreground) {
         if (daemonize(pid_path, log_path, false) != 0) {
             fprintf(stderr, "daemonize failed: %s\n", strerror(errno));
@@ -85,21 +136,31 @@ int main(int argc, char **argv) {
     } else {
         log_init(log_path, 1);
     }
+    if (log_async && log_start_async(log_policy) != 0)
+        log_msg("async logging unavailable, logging synchronously\n");
 
     log_msg("hostd " HOSTD_VERSION " starting\n");
 
+    stats_init();
     if (vm_init() != 0) {
         log_msg("vm_init failed\n");
         return 1;
     }
+    if (data_dir && vm_persist_open(data_dir, commit_window_us) != 0) {
+        log_msg("cannot open data dir %s\n", data_dir);
+        return 1;
+    }
 
     int rc = 0;
-    if (tcp_port > 0) {
+    if (tcp_port > 0 && sock_set) {
+        log_msg("mode=unix+tcp socket=%s bind=%s:%d\n", sock_path, tcp_host[0]?tcp_host:"0.0.0.0", tcp_port);
+        rc = server_run_listeners(sock_path, tcp_host[0]?tcp_host:NULL, tcp_port, workers);
+    } else if (tcp_port > 0) {
         log_msg("mode=tcp bind=%s:%d\n", tcp_host[0]?tcp_host:"0.0.0.0", tcp_port);
-        rc = server_run_tcp(tcp_host[0]?tcp_host:NULL, tcp_port);
+        rc = server_run_listeners(NULL, tcp_host[0]?tcp_host:NULL, tcp_port, workers);
     } else {
         log_msg("mode=unix socket=%s\n", sock_path);
-        rc = server_run(sock_path);
+        rc = server_run_listeners(sock_path, NULL, 0, workers);
     }
 
     vm_shutdown();
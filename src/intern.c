@@ -0,0 +1,148 @@
+// intern.c - reference-counted string intern table
+//
+// Entries live in a growable array indexed by ref; a linear-probing hash
+// of refs (backward-shift deletion, no tombstones) finds them by content.
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+typedef struct {
+    char    *str;           // NUL-terminated copy; NULL while the entry is free
+    uint32_t len;
+    uint32_t hash;
+    uint32_t refs;          // free-list link while str == NULL
+} entry_t;
+
+static entry_t  *entries;
+static uint32_t  nentries, entry_cap;
+static uint32_t  free_entry = INTERN_NONE;
+static uint32_t *table;         // refs, INTERN_NONE = empty
+static uint32_t  table_cap;     // power of two
+static uint32_t  live;
+
+static uint32_t hash_bytes(const char *s, size_t len) {
+    uint32_t h = 2166136261u;   // FNV-1a
+    for (size_t i=0;i<len;i++) { h ^= (unsigned char)s[i]; h *= 16777619u; }
+    return h;
+}
+
+static int table_resize(uint32_t ncap) {
+    uint32_t *nt = malloc(ncap * sizeof(*nt));
+    if (!nt) return -1;
+    for (uint32_t i=0;i<ncap;i++) nt[i] = INTERN_NONE;
+    for (uint32_t i=0;i<table_cap;i++) {
+        uint32_t ref = table[i];
+        if (ref == INTERN_NONE) continue;
+        uint32_t p = entries[ref].hash & (ncap-1);
+        while (nt[p] != INTERN_NONE) p = (p+1) & (ncap-1);
+        nt[p] = ref;
+    }
+    free(table);
+    table = nt;
+    table_cap = ncap;
+    return 0;
+}
+
+int intern_init(void) {
+    intern_shutdown();
+    return table_resize(1024);
+}
+
+void intern_shutdown(void) {
+    for (uint32_t i=0;i<nentries;i++) free(entries[i].str);
+    free(entries);
+    free(table);
+    entries = NULL;
+    table = NULL;
+    nentries = entry_cap = table_cap = live = 0;
+    free_entry = INTERN_NONE;
+}
+
+static uint32_t alloc_entry(void) {
+    if (free_entry != INTERN_NONE) {
+        uint32_t ref = free_entry;
+        free_entry = entries[ref].refs;
+        return ref;
+    }
+    if (nentries == entry_cap) {
+        uint32_t ncap = entry_cap ? entry_cap * 2 : 1024;
+        entry_t *n = realloc(entries, ncap * sizeof(*n));
+        if (!n) return INTERN_NONE;
+        entries = n;
+        entry_cap = ncap;
+    }
+    return nentries++;
+}
+
+uint32_t intern_put(const char *s, size_t len) {
+    if (!table && table_resize(1024) != 0) return INTERN_NONE;
+    uint32_t h = hash_bytes(s, len);
+    uint32_t p = h & (table_cap-1);
+    for (; table[p] != INTERN_NONE; p = (p+1) & (table_cap-1)) {
+        entry_t *e = &entries[table[p]];
+        if (e->hash == h && e->len == len && memcmp(e->str, s, len) == 0) {
+            e->refs++;
+            return table[p];
+        }
+    }
+
+    // keep the load factor under 1/2 so probes stay short
+    if ((live + 1) * 2 > table_cap) {
+        if (table_resize(table_cap * 2) != 0) return INTERN_NONE;
+        p = h & (table_cap-1);
+        while (table[p] != INTERN_NONE) p = (p+1) & (table_cap-1);
+    }
+    uint32_t ref = alloc_entry();
+    if (ref == INTERN_NONE) return INTERN_NONE;
+    char *copy = malloc(len + 1);
+    if (!copy) {
+        entries[ref].str = NULL;
+        entries[ref].refs = free_entry;
+        free_entry = ref;
+        return INTERN_NONE;
+    }
+    memcpy(copy, s, len);
+    copy[len] = 0;
+    entries[ref] = (entry_t){ copy, (uint32_t)len, h, 1 };
+    table[p] = ref;
+    live++;
+    return ref;
+}
+
+void intern_drop(uint32_t ref) {
+    if (ref == INTERN_NONE || ref >= nentries || !entries[ref].str) return;
+    entry_t *e = &entries[ref];
+    if (--e->refs > 0) return;
+
+    // unlink from the hash, shifting later members of the probe run back
+    uint32_t mask = table_cap - 1;
+    uint32_t p = e->hash & mask;
+    while (table[p] != ref) p = (p+1) & mask;
+    uint32_t q = p;
+    for (;;) {
+        q = (q+1) & mask;
+        if (table[q] == INTERN_NONE) break;
+        uint32_t home = entries[table[q]].hash & mask;
+        // move table[q] into the hole unless its home lies in (p, q]
+        if ((q > p) ? (home <= p || home > q) : (home <= p && home > q)) {
+            table[p] = table[q];
+            p = q;
+        }
+    }
+    table[p] = INTERN_NONE;
+    live--;
+
+    free(e->str);
+    e->str = NULL;
+    e->refs = free_entry;
+    free_entry = ref;
+}
+
+const char *intern_str(uint32_t ref) {
+    return (ref < nentries && entries[ref].str) ? entries[ref].str : "";
+}
+
+size_t intern_len(uint32_t ref) {
+    return (ref < nentries && entries[ref].str) ? entries[ref].len : 0;
+}
@@ -0,0 +1,602 @@
+// journal.c - snapshot and journal files for the VM store
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "journal.h"
+#include "libvm.h"
+#include "hist.h"
+#include "log.h"
+
+#define SNAP_MAGIC "HOSTDSNP"
+#define JNL_MAGIC  "HOSTDJNL"
+#define FORMAT_VERSION 1
+
+#define QUEUE_MAX   (64u << 20)     // appenders wait while this much is unwritten
+#define QUEUE_FLUSH (1u << 20)      // ends a commit window early
+#define MAX_NOTIFY  512
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t hdr_size;
+    uint64_t gen;
+    uint64_t nslots;
+    uint64_t nlive;
+    uint64_t names_len;
+    uint64_t reserved[2];
+} snap_hdr_t;
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t pad;
+    uint64_t gen;
+} jnl_hdr_t;
+
+static char     jdir[PATH_MAX];
+static int      jfd = -1;
+static uint64_t jgen;           // generation of the open journal
+static uint64_t jsize;          // its valid length
+static uint64_t jops;           // ops in it
+static void    *map_base;       // snapshot mapping
+static size_t   map_len;
+
+// Group commit. Appenders copy records into qbuf and get a sequence
+// number; the writer thread takes the whole queue, writes it with one
+// pwrite and one fdatasync, and only then advances `durable` and pokes the
+// registered eventfds. jfd, jsize and the queue are guarded by jmu.
+static pthread_mutex_t jmu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  jwork = PTHREAD_COND_INITIALIZER;   // queue went non-empty, or stop
+static pthread_cond_t  jdone = PTHREAD_COND_INITIALIZER;   // a commit finished
+static pthread_cond_t  jspace = PTHREAD_COND_INITIALIZER;  // the queue was taken
+static pthread_t writer;
+static int       writer_on, writer_stop;
+static char     *qbuf, *wbuf;
+static size_t    qlen, qcap, wcap;
+static uint64_t  qrecs;
+static uint64_t  lsn_last;       // last sequence number handed out
+static uint64_t  durable;        // every record up to here is synced
+static int       jfailed;        // a write or sync failed; nothing more becomes durable
+static int       writing;        // the writer has a batch in flight
+static unsigned  window_us;
+static int       notify_fd[MAX_NOTIFY];
+static int       nnotify;
+
+// written by the writer only, read by journal_stats
+static uint64_t  n_commits, n_records, n_bytes;
+static hist_t    h_batch, h_fsync;
+
+// ----- crc32 (IEEE, reflected) -----
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+    for (uint32_t i=0;i<256;i++) {
+        uint32_t c = i;
+        for (int k=0;k<8;k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_buf(const char *p, size_t n) {
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i=0;i<n;i++) c = crc_table[(c ^ (unsigned char)p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+// ----- helpers -----
+
+static void path_of(char *out, size_t outsz, const char *name) {
+    snprintf(out, outsz, "%s/%s", jdir, name);
+}
+
+static void journal_path(char *out, size_t outsz, uint64_t gen) {
+    snprintf(out, outsz, "%s/journal.%llu", jdir, (unsigned long long)gen);
+}
+
+// New directory entries only survive a crash once the directory is synced.
+static int sync_dir(void) {
+    int fd = open(jdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+static int write_full(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) { n -= (ssize_t)iov->iov_len; iov++; cnt--; }
+        if (cnt > 0) { iov->iov_base = (char *)iov->iov_base + n; iov->iov_len -= (size_t)n; }
+    }
+    return 0;
+}
+
+size_t jop_encode(char *dst, const jop_t *op) {
+    dst[0] = (char)op->op;
+    dst[1] = (char)op->state;
+    dst[2] = (char)op->name_len;
+    dst[3] = 0;
+    memcpy(dst + 4, &op->id, 4);
+    memcpy(dst + 8, &op->mem_mib, 4);
+    memcpy(dst + JOP_HDR, op->name, op->name_len);
+    return JOP_HDR + op->name_len;
+}
+
+// ----- open/close -----
+
+int journal_open(const char *dir) {
+    static int crc_ready;
+    if (!crc_ready) { crc_init(); crc_ready = 1; }
+    if (snprintf(jdir, sizeof(jdir), "%s", dir) >= (int)sizeof(jdir)) return -1;
+    if (mkdir(jdir, 0755) != 0 && errno != EEXIST) {
+        LOGE(LOG_SYS_LIBVM, "mkdir(%s): %s\n", jdir, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void journal_close(void) {
+    if (writer_on) {
+        pthread_mutex_lock(&jmu);
+        writer_stop = 1;                // the writer drains the queue first
+        pthread_cond_signal(&jwork);
+        pthread_mutex_unlock(&jmu);
+        pthread_join(writer, NULL);
+        writer_on = 0;
+    }
+    if (jfd >= 0) close(jfd);
+    jfd = -1;
+    jgen = jsize = jops = 0;
+    free(qbuf);
+    free(wbuf);
+    qbuf = wbuf = NULL;
+    qlen = qcap = wcap = 0;
+    qrecs = lsn_last = durable = 0;
+}
+
+// ----- snapshot -----
+
+// Byte offsets of the arrays after the header; each starts 8-aligned.
+static void snap_layout(uint64_t nslots, uint64_t off[5]) {
+    uint64_t at = sizeof(snap_hdr_t);
+    const uint64_t size[4] = { nslots * 4, nslots * 4, nslots, nslots * 4 };
+    for (int i=0;i<4;i++) {
+        off[i] = at;
+        at = (at + size[i] + 7) & ~(uint64_t)7;
+    }
+    off[4] = at;    // names
+}
+
+int journal_map_snapshot(jsnap_t *snap) {
+    char path[PATH_MAX + 16];
+    path_of(path, sizeof(path), "snapshot");
+    memset(snap, 0, sizeof(*snap));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT ? 0 : -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snap_hdr_t)) { close(fd); return -1; }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+
+    const snap_hdr_t *h = base;
+    uint64_t off[5];
+    snap_layout(h->nslots, off);
+    if (memcmp(h->magic, SNAP_MAGIC, 8) != 0 || h->version != FORMAT_VERSION ||
+        h->hdr_size != sizeof(snap_hdr_t) || h->nslots > UINT32_MAX ||
+        off[4] + h->names_len != (uint64_t)st.st_size) {
+        LOGE(LOG_SYS_LIBVM, "%s: not a snapshot this version can read\n", path);
+        munmap(base, (size_t)st.st_size);
+        return -1;
+    }
+    const char *b = base;
+    snap->gen       = h->gen;
+    snap->nslots    = h->nslots;
+    snap->nlive     = h->nlive;
+    snap->id        = (const int32_t *)(b + off[0]);
+    snap->mem_mib   = (const int32_t *)(b + off[1]);
+    snap->state     = (const uint8_t *)(b + off[2]);
+    snap->name_off  = (const uint32_t *)(b + off[3]);
+    snap->names     = b + off[4];
+    snap->names_len = h->names_len;
+    map_base = base;
+    map_len = (size_t)st.st_size;
+    return 1;
+}
+
+void journal_unmap_snapshot(jsnap_t *snap) {
+    if (map_base) munmap(map_base, map_len);
+    map_base = NULL;
+    map_len = 0;
+    memset(snap, 0, sizeof(*snap));
+}
+
+int journal_write_snapshot(const jsnap_t *snap) {
+    char tmp[PATH_MAX + 16], path[PATH_MAX + 16];
+    path_of(tmp, sizeof(tmp), "snapshot.tmp");
+    path_of(path, sizeof(path), "snapshot");
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOGE(LOG_SYS_LIBVM, "%s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+
+    snap_hdr_t h = {0};
+    memcpy(h.magic, SNAP_MAGIC, 8);
+    h.version   = FORMAT_VERSION;
+    h.hdr_size  = sizeof(h);
+    h.gen       = snap->gen;
+    h.nslots    = snap->nslots;
+    h.nlive     = snap->nlive;
+    h.names_len = snap->names_len;
+
+    uint64_t off[5];
+    snap_layout(snap->nslots, off);
+    static const char zeros[8];
+    const void *part[5] = { snap->id, snap->mem_mib, snap->state, snap->name_off, snap->names };
+    const uint64_t size[5] = { snap->nslots * 4, snap->nslots * 4, snap->nslots, snap->nslots * 4, snap->names_len };
+    struct iovec iov[11];
+    int cnt = 0;
+    uint64_t at = sizeof(h);
+    iov[cnt++] = (struct iovec){ &h, sizeof(h) };
+    for (int i=0;i<5;i++) {
+        if (off[i] > at) iov[cnt++] = (struct iovec){ (void *)zeros, off[i] - at };
+        iov[cnt++] = (struct iovec){ (void *)part[i], size[i] };
+        at = off[i] + size[i];
+    }
+    int rc = write_full(fd, iov, cnt);
+    if (rc == 0) rc = fdatasync(fd);
+    if (close(fd) != 0) rc = -1;
+    if (rc == 0) rc = rename(tmp, path);
+    if (rc == 0) rc = sync_dir();
+    if (rc != 0) {
+        LOGE(LOG_SYS_LIBVM, "writing %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+
+    // the snapshot now covers everything before its generation
+    for (uint64_t g = snap->gen; g-- > 0; ) {
+        char jp[PATH_MAX + 32];
+        journal_path(jp, sizeof(jp), g);
+        if (unlink(jp) != 0) break;
+    }
+    return 0;
+}
+
+// ----- journal -----
+
+// caller holds jmu, or is the only thread (replay)
+static int journal_create(uint64_t gen) {
+    char path[PATH_MAX + 32];
+    journal_path(path, sizeof(path), gen);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOGE(LOG_SYS_LIBVM, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    jnl_hdr_t h = {0};
+    memcpy(h.magic, JNL_MAGIC, 8);
+    h.version = FORMAT_VERSION;
+    h.gen = gen;
+    struct iovec iov = { &h, sizeof(h) };
+    if (write_full(fd, &iov, 1) != 0 || fdatasync(fd) != 0 || sync_dir() != 0) {
+        LOGE(LOG_SYS_LIBVM, "%s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (jfd >= 0) close(jfd);
+    jfd = fd;
+    jgen = gen;
+    jsize = sizeof(h);
+    jops = 0;
+    return 0;
+}
+
+// Apply one journal file; leaves it as the open journal. Returns ops
+// applied, -1 on error.
+static long replay_file(int fd, const char *path, uint64_t gen, int (*fn)(const jop_t *, void *), void *arg) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+    size_t size = (size_t)st.st_size;
+    char *buf = size ? malloc(size) : NULL;
+    if (size && !buf) return -1;
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(fd, buf + got, size - got, (off_t)got);
+        if (n <= 0) { if (n < 0 && errno == EINTR) continue; free(buf); return -1; }
+        got += (size_t)n;
+    }
+
+    jnl_hdr_t h;
+    if (size < sizeof(h)) {
+        // crashed while creating it: nothing was ever appended
+        free(buf);
+        return journal_create(gen) == 0 ? 0 : -1;
+    }
+    memcpy(&h, buf, sizeof(h));
+    if (memcmp(h.magic, JNL_MAGIC, 8) != 0 || h.version != FORMAT_VERSION || h.gen != gen) {
+        LOGE(LOG_SYS_LIBVM, "%s: not a journal this version can read\n", path);
+        free(buf);
+        return -1;
+    }
+
+    size_t off = sizeof(h);
+    long ops = 0;
+    while (size - off >= 8) {
+        uint32_t len, crc;
+        memcpy(&len, buf + off, 4);
+        memcpy(&crc, buf + off + 4, 4);
+        if (size - off - 8 < len || crc32_buf(buf + off + 8, len) != crc) break;
+        // decode everything first: a record is applied whole or not at all
+        const char *p = buf + off + 8, *end = p + len;
+        size_t nops = 0;
+        while (end - p >= JOP_HDR && end - p >= JOP_HDR + (unsigned char)p[2]) { p += JOP_HDR + (unsigned char)p[2]; nops++; }
+        if (p != end || nops == 0) break;
+        for (p = buf + off + 8; p < end; p += JOP_HDR + (unsigned char)p[2]) {
+            jop_t op = { (uint8_t)p[0], (uint8_t)p[1], (uint8_t)p[2], 0, 0, p + JOP_HDR };
+            memcpy(&op.id, p + 4, 4);
+            memcpy(&op.mem_mib, p + 8, 4);
+            if (fn(&op, arg) != 0) {
+                LOGE(LOG_SYS_LIBVM, "%s: op %d on id=%d does not apply at offset %zu\n", path, op.op, op.id, off);
+                free(buf);
+                return -1;
+            }
+        }
+        ops += (long)nops;
+        off += 8 + len;
+    }
+    free(buf);
+    if (off < size) {
+        LOGW(LOG_SYS_LIBVM, "%s: dropping %zu bytes of torn or corrupt tail\n", path, size - off);
+        if (ftruncate(fd, (off_t)off) != 0 || fdatasync(fd) != 0) return -1;
+    }
+    if (jfd >= 0) close(jfd);
+    jfd = fd;
+    jgen = gen;
+    jsize = off;
+    jops = (uint64_t)ops;
+    return ops;
+}
+
+long journal_replay(uint64_t gen, int (*fn)(const jop_t *op, void *arg), void *arg) {
+    // journals older than the snapshot outlived a crash during compaction
+    for (uint64_t g = gen; g-- > 0; ) {
+        char jp[PATH_MAX + 32];
+        journal_path(jp, sizeof(jp), g);
+        if (unlink(jp) != 0) break;
+    }
+
+    long total = 0;
+    uint64_t g = gen;
+    for (;; g++) {
+        char path[PATH_MAX + 32];
+        journal_path(path, sizeof(path), g);
+        int fd = open(path, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno == ENOENT) break;
+            LOGE(LOG_SYS_LIBVM, "%s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        long n = replay_file(fd, path, g, fn, arg);
+        if (jfd != fd) close(fd);
+        if (n < 0) return -1;
+        total += n;
+    }
+    if (g == gen && journal_create(gen) != 0) return -1;
+    return total;
+}
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int pwrite_full(int fd, const char *p, size_t n, off_t off) {
+    while (n > 0) {
+        ssize_t k = pwrite(fd, p, n, off);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += k;
+        n -= (size_t)k;
+        off += k;
+    }
+    return 0;
+}
+
+// Let more records join the batch until the window closes or enough
+// bytes are waiting. caller holds jmu
+static void commit_window(void) {
+    struct timespec dl;
+    clock_gettime(CLOCK_REALTIME, &dl);
+    dl.tv_nsec += (long)window_us * 1000;
+    dl.tv_sec += dl.tv_nsec / 1000000000;
+    dl.tv_nsec %= 1000000000;
+    while (!writer_stop && qlen < QUEUE_FLUSH)
+        if (pthread_cond_timedwait(&jwork, &jmu, &dl) == ETIMEDOUT) break;
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&jmu);
+    for (;;) {
+        while (qlen == 0 && !writer_stop) pthread_cond_wait(&jwork, &jmu);
+        if (qlen == 0) break;
+        if (window_us) commit_window();
+
+        // take the queue; appenders refill the other buffer meanwhile
+        char *b = qbuf; qbuf = wbuf; wbuf = b;
+        size_t c = qcap; qcap = wcap; wcap = c;
+        size_t len = qlen;
+        uint64_t recs = qrecs, upto = lsn_last;
+        int fd = jfd, failed = jfailed;
+        off_t off = (off_t)jsize;
+        qlen = 0;
+        qrecs = 0;
+        jsize += len;
+        writing = 1;
+        pthread_cond_broadcast(&jspace);
+        pthread_mutex_unlock(&jmu);
+
+        // checksums are filled in here, off the store lock
+        for (size_t at = 0; at < len; ) {
+            uint32_t rlen;
+            memcpy(&rlen, wbuf + at, 4);
+            uint32_t crc = crc32_buf(wbuf + at + 8, rlen);
+            memcpy(wbuf + at + 4, &crc, 4);
+            at += 8 + rlen;
+        }
+        int rc = failed ? -1 : pwrite_full(fd, wbuf, len, off);
+        uint64_t t0 = mono_ns();
+        if (rc == 0) rc = fdatasync(fd);
+        uint64_t sync_ns = mono_ns() - t0;
+        int err = errno;
+
+        pthread_mutex_lock(&jmu);
+        writing = 0;
+        if (rc == 0) {
+            durable = upto;
+            __atomic_store_n(&n_commits, n_commits + 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&n_records, n_records + recs, __ATOMIC_RELAXED);
+            __atomic_store_n(&n_bytes, n_bytes + len, __ATOMIC_RELAXED);
+            hist_record(&h_batch, recs);
+            hist_record(&h_fsync, sync_ns);
+        } else if (!jfailed) {
+            // the page cache may have dropped what it could not write: no
+            // later sync can vouch for it, so stop acknowledging anything
+            LOGE(LOG_SYS_LIBVM, "journal write failed, changes are no longer durable: %s\n", strerror(err));
+            jfailed = 1;
+        }
+        pthread_cond_broadcast(&jdone);
+        pthread_cond_broadcast(&jspace);
+        for (int i=0;i<nnotify;i++) {
+            uint64_t one = 1;
+            if (write(notify_fd[i], &one, sizeof(one)) < 0) {}
+        }
+    }
+    pthread_mutex_unlock(&jmu);
+    return NULL;
+}
+
+int journal_start(unsigned commit_window_us) {
+    if (writer_on) return -1;
+    window_us = commit_window_us;
+    writer_stop = 0;
+    jfailed = 0;
+    if (pthread_create(&writer, NULL, writer_main, NULL) != 0) return -1;
+    writer_on = 1;
+    return 0;
+}
+
+uint64_t journal_append(const char *buf, size_t len, size_t nops) {
+    pthread_mutex_lock(&jmu);
+    while (writer_on && !jfailed && qlen > 0 && qlen + 8 + len > QUEUE_MAX) pthread_cond_wait(&jspace, &jmu);
+    if (!writer_on || jfailed || len > UINT32_MAX) { pthread_mutex_unlock(&jmu); return 0; }
+    if (qcap - qlen < 8 + len) {
+        size_t ncap = qcap ? qcap : 64 * 1024;
+        while (ncap - qlen < 8 + len) ncap *= 2;
+        char *n = realloc(qbuf, ncap);
+        if (!n) { pthread_mutex_unlock(&jmu); return 0; }
+        qbuf = n;
+        qcap = ncap;
+    }
+    uint32_t hdr[2] = { (uint32_t)len, 0 };     // crc: see writer_main
+    memcpy(qbuf + qlen, hdr, sizeof(hdr));
+    memcpy(qbuf + qlen + sizeof(hdr), buf, len);
+    qlen += sizeof(hdr) + len;
+    qrecs++;
+    jops += nops;
+    uint64_t lsn = ++lsn_last;
+    if (qrecs == 1 || (window_us && qlen >= QUEUE_FLUSH)) pthread_cond_signal(&jwork);
+    pthread_mutex_unlock(&jmu);
+    return lsn;
+}
+
+int journal_synced(uint64_t lsn) {
+    pthread_mutex_lock(&jmu);
+    int st = lsn <= durable ? 1 : jfailed ? -1 : 0;
+    pthread_mutex_unlock(&jmu);
+    return st;
+}
+
+// caller holds jmu
+static int flush_locked(void) {
+    uint64_t target = lsn_last;
+    pthread_cond_signal(&jwork);
+    while (writer_on && durable < target && !jfailed) pthread_cond_wait(&jdone, &jmu);
+    return durable >= target ? 0 : -1;
+}
+
+int journal_flush(void) {
+    pthread_mutex_lock(&jmu);
+    int rc = flush_locked();
+    pthread_mutex_unlock(&jmu);
+    return rc;
+}
+
+int journal_notify(int fd, int on) {
+    int rc = 0;
+    pthread_mutex_lock(&jmu);
+    if (on) {
+        if (nnotify < MAX_NOTIFY) notify_fd[nnotify++] = fd;
+        else rc = -1;
+    } else {
+        for (int i=0;i<nnotify;i++) if (notify_fd[i] == fd) { notify_fd[i] = notify_fd[--nnotify]; break; }
+    }
+    pthread_mutex_unlock(&jmu);
+    return rc;
+}
+
+uint64_t journal_ops(void) { return jops; }
+
+int journal_rotate(uint64_t *gen) {
+    pthread_mutex_lock(&jmu);
+    // everything queued belongs to the old generation
+    int rc = flush_locked();
+    while (rc == 0 && writing) pthread_cond_wait(&jdone, &jmu);
+    if (rc == 0) rc = journal_create(jgen + 1);
+    if (rc == 0) *gen = jgen;
+    pthread_mutex_unlock(&jmu);
+    return rc;
+}
+
+void journal_stats(struct vm_persist_stats *out) {
+    static hist_t b, f;         // too big for the stack; callers are serialized by jmu
+    pthread_mutex_lock(&jmu);
+    memset(&b, 0, sizeof(b));
+    memset(&f, 0, sizeof(f));
+    hist_merge(&b, &h_batch);
+    hist_merge(&f, &h_fsync);
+    out->commits      = n_commits;
+    out->records      = n_records;
+    out->bytes        = n_bytes;
+    out->pending      = lsn_last - durable;
+    out->batch_p50    = hist_quantile(&b, 0.5);
+    out->batch_p99    = hist_quantile(&b, 0.99);
+    out->batch_max    = b.max;
+    out->fsync_p50_ns = hist_quantile(&f, 0.5);
+    out->fsync_p99_ns = hist_quantile(&f, 0.99);
+    out->fsync_max_ns = f.max;
+    out->fsync_sum_ns = f.sum;
+    out->failed       = jfailed;
+    pthread_mutex_unlock(&jmu);
+}
@@ -2,63 +2,678 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "libvm.h"
+#include "intern.h"
+#include "journal.h"
+#include "log.h"
 
-#define MAX_VMS 128
+// VM ids are generational slot handles: the low SLOT_BITS hold slot+1, the
+// bits above hold the slot's generation, bumped on every destroy so a stale
+// id never matches whatever reuses the slot. The first VM in a fresh slot
+// keeps generation 0, so ids start at 1 as before.
+#define SLOT_BITS 22
+#define SLOT_MASK ((1u << SLOT_BITS) - 1)
+#define GEN_MASK  ((1u << (31 - SLOT_BITS)) - 1)   // keeps ids positive
+#define MAX_VMS   ((size_t)SLOT_MASK)
 
-static vm_t vms[MAX_VMS];
-static size_t vcount = 0;
-static int next_id = 1;
+// Slots live in fixed-size chunks that are never reallocated, so growing
+// the store only copies the chunk directory and existing entries never move.
+#define CHUNK_SHIFT 12
+#define CHUNK_SLOTS (1u << CHUNK_SHIFT)
 
-int vm_init(void) {
+#define STATE_FREE 0xFF         // state[] of a slot with no VM in it
+
+// Struct-of-arrays per chunk: scans by state or memory touch only the
+// arrays they need (5 bytes per VM for a memory-by-state sum) instead of
+// dragging whole vm_t records through the cache.
+typedef struct {
+    int32_t  id[CHUNK_SLOTS];       // current handle; next occupant's handle while free
+    int32_t  mem_mib[CHUNK_SLOTS];
+    uint8_t  state[CHUNK_SLOTS];    // vm_state_t, or STATE_FREE
+    uint32_t name[CHUNK_SLOTS];     // intern.h ref
+    int32_t  next_free[CHUNK_SLOTS];
+} chunk_t;
+
+// Readers (list/info) share the table; create/destroy take it exclusively.
+static pthread_rwlock_t vlock = PTHREAD_RWLOCK_INITIALIZER;
+static chunk_t **chunks = NULL;
+static size_t nchunks = 0;      // chunks allocated
+static size_t chunk_cap = 0;    // directory capacity
+static size_t nslots = 0;       // slots ever handed out (high-water mark)
+static size_t vcount = 0;       // live VMs
+static int free_head = -1;
+
+// Set while this thread holds vlock exclusively for a batch; the calls it
+// makes inside the batch must not lock again.
+static __thread int in_batch;
+
+static void rdlock(void) { if (!in_batch) pthread_rwlock_rdlock(&vlock); }
+static void wrlock(void) { if (!in_batch) pthread_rwlock_wrlock(&vlock); }
+static void unlock(void) { if (!in_batch) pthread_rwlock_unlock(&vlock); }
+
+// Batch undo log: enough of each create/destroy to reverse it. A destroy's
+// name ref is only dropped at commit, so an abort can hand it back.
+enum { UNDO_CREATE, UNDO_GROW, UNDO_DESTROY };
+typedef struct {
+    uint8_t  op;
+    uint8_t  state;
+    uint32_t idx;
+    int32_t  id;
+    int32_t  mem_mib;
+    uint32_t name;
+} undo_t;
+static undo_t *undo = NULL;
+static size_t nundo = 0, undo_cap = 0;
+
+// Persistence (journal.h). Every create and destroy is queued to the
+// journal under vlock before it touches the table; inside a batch the ops
+// collect in jbuf and go out as one record at commit. last_lsn is the
+// journal sequence number of this thread's latest change, which the
+// server holds its reply back on until the journal has synced it.
+static int persisting;
+static __thread uint64_t last_lsn;
+static char *jbuf = NULL;
+static size_t jbuf_len = 0, jbuf_cap = 0, jbuf_ops = 0;
+
+// Compact once the journal holds this many ops and more than the store
+// has VMs, so replay never costs more than loading the snapshot.
+#define COMPACT_MIN_OPS 100000
+
+static pthread_t compactor;
+static pthread_mutex_t compact_mu = PTHREAD_MUTEX_INITIALIZER;  // one compaction at a time
+static pthread_mutex_t wake_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cv = PTHREAD_COND_INITIALIZER;
+static int compactor_stop;
+
+#define CHUNK(i) (chunks[(size_t)(i) >> CHUNK_SHIFT])
+#define CIDX(i)  ((size_t)(i) & (CHUNK_SLOTS-1))
+
+static const char *const state_names[VM_STATE_COUNT] = { "stopped", "running", "paused" };
+
+const char *vm_state_name(vm_state_t s) {
+    return ((unsigned)s < VM_STATE_COUNT) ? state_names[s] : "unknown";
+}
+
+static void reset_locked(void) {
+    for (size_t i=0;i<nchunks;i++) free(chunks[i]);
+    free(chunks);
+    chunks = NULL;
+    nchunks = chunk_cap = 0;
+    nslots = 0;
     vcount = 0;
-    next_id = 1;
+    free_head = -1;
+    free(undo);
+    undo = NULL;
+    nundo = undo_cap = 0;
+    free(jbuf);
+    jbuf = NULL;
+    jbuf_len = jbuf_cap = jbuf_ops = 0;
+    intern_shutdown();
+}
+
+// caller holds vlock exclusively; makes room for slot index `nslots`
+static int grow_locked(void) {
+    if (nslots >= MAX_VMS) return -1;
+    if ((nslots >> CHUNK_SHIFT) < nchunks) return 0;
+    if (nchunks == chunk_cap) {
+        size_t ncap = chunk_cap ? chunk_cap * 2 : 16;
+        chunk_t **n = realloc(chunks, ncap * sizeof(*n));
+        if (!n) return -1;
+        chunks = n;
+        chunk_cap = ncap;
+    }
+    chunks[nchunks] = malloc(sizeof(chunk_t));
+    if (!chunks[nchunks]) return -1;
+    nchunks++;
     return 0;
 }
 
+int vm_init(void) {
+    pthread_rwlock_wrlock(&vlock);
+    reset_locked();
+    int rc = intern_init();
+    pthread_rwlock_unlock(&vlock);
+    return rc;
+}
+
+static void persist_stop(void);
+
 int vm_shutdown(void) {
-    vcount = 0;
+    if (persisting) persist_stop();
+    pthread_rwlock_wrlock(&vlock);
+    reset_locked();
+    pthread_rwlock_unlock(&vlock);
     return 0;
 }
 
+// Conversion to the public record. caller holds vlock
+static void export_vm(size_t idx, vm_t *out) {
+    const chunk_t *c = CHUNK(idx);
+    size_t k = CIDX(idx);
+    out->id = c->id[k];
+    out->mem_mib = c->mem_mib[k];
+    size_t nlen = intern_len(c->name[k]);     // < sizeof(out->name), enforced at create
+    memcpy(out->name, intern_str(c->name[k]), nlen + 1);
+    out->state_code = (vm_state_t)c->state[k];
+    const char *st = vm_state_name(out->state_code);
+    memcpy(out->state, st, strlen(st) + 1);
+}
+
+// Slots never move, so listing in slot order is stable: a VM keeps its
+// position relative to every other VM for as long as it exists.
 int vm_list(vm_t *out, size_t max, size_t *count) {
+    rdlock();
     if (count) *count = vcount;
-    if (!out) return 0;
-    size_t n = (vcount < max) ? vcount : max;
-    for (size_t i=0;i<n;i++) out[i] = vms[i];
+    if (out) {
+        size_t n = 0;
+        for (size_t i=0; i<nslots && n<max; i++) {
+            if (CHUNK(i)->state[CIDX(i)] != STATE_FREE) export_vm(i, &out[n++]);
+        }
+    }
+    unlock();
     return 0;
 }
 
-static int find_index(int id) {
-    for (size_t i=0;i<vcount;i++) if (vms[i].id == id) return (int)i;
-    return -1;
+// Cursors are slot indices, so they stay valid across creates and destroys:
+// a walk sees every VM that lives through it exactly once.
+int vm_list_from(size_t *cursor, vm_t *out, size_t max, size_t *got) {
+    size_t n = 0;
+    rdlock();
+    size_t i = *cursor;
+    for (; i<nslots && n<max; i++) {
+        if (CHUNK(i)->state[CIDX(i)] != STATE_FREE) export_vm(i, &out[n++]);
+    }
+    // skip trailing free slots so "more" means another VM really follows
+    while (i<nslots && CHUNK(i)->state[CIDX(i)] == STATE_FREE) i++;
+    int more = i < nslots;
+    unlock();
+    *cursor = i;
+    if (got) *got = n;
+    return more;
+}
+
+// Slot index for a live id, or -1. caller holds vlock
+static long lookup(int id) {
+    if (id <= 0) return -1;
+    size_t idx = ((uint32_t)id & SLOT_MASK) - 1;
+    if (idx >= nslots) return -1;
+    const chunk_t *c = CHUNK(idx);
+    size_t k = CIDX(idx);
+    return (c->id[k] == id && c->state[k] != STATE_FREE) ? (long)idx : -1;
+}
+
+// Reserve a log entry before mutating, so a full log fails the call cleanly.
+// caller holds vlock exclusively
+static undo_t *undo_push(void) {
+    if (nundo == undo_cap) {
+        size_t ncap = undo_cap ? undo_cap * 2 : 64;
+        undo_t *n = realloc(undo, ncap * sizeof(*n));
+        if (!n) return NULL;
+        undo = n;
+        undo_cap = ncap;
+    }
+    return &undo[nundo++];
+}
+
+// Journal one op, or queue it for the batch's record. caller holds vlock
+// exclusively
+static int journal_op(const jop_t *op) {
+    if (!persisting) return 0;
+    if (!in_batch) {
+        char rec[JOP_MAX];
+        uint64_t lsn = journal_append(rec, jop_encode(rec, op), 1);
+        if (!lsn) return -1;
+        last_lsn = lsn;
+        return 0;
+    }
+    if (jbuf_cap - jbuf_len < JOP_MAX) {
+        size_t ncap = jbuf_cap ? jbuf_cap * 2 : 4096;
+        char *n = realloc(jbuf, ncap);
+        if (!n) return -1;
+        jbuf = n;
+        jbuf_cap = ncap;
+    }
+    jbuf_len += jop_encode(jbuf + jbuf_len, op);
+    jbuf_ops++;
+    return 0;
 }
 
 int vm_create(const char *name, int mem_mib, int *out_id) {
-    if (vcount >= MAX_VMS) return -1;
-    vm_t v = {0};
-    v.id = next_id++;
-    snprintf(v.name, sizeof(v.name), "%s", name?name:"vm");
-    v.mem_mib = mem_mib>0?mem_mib:512;
-    snprintf(v.state, sizeof(v.state), "%s", "stopped");
-    vms[vcount++] = v;
-    if (out_id) *out_id = v.id;
+    if (!name) name = "vm";
+    size_t nlen = strnlen(name, sizeof(((vm_t*)0)->name) - 1);
+
+    wrlock();
+    size_t idx;
+    if (free_head >= 0) {
+        idx = (size_t)free_head;
+    } else if (grow_locked() == 0) {
+        idx = nslots;
+        CHUNK(idx)->id[CIDX(idx)] = (int32_t)(idx + 1);    // generation 0
+    } else {
+        unlock();
+        return -1;
+    }
+    undo_t *u = in_batch ? undo_push() : NULL;
+    if (in_batch && !u) { unlock(); return -1; }
+    uint32_t ref = intern_put(name, nlen);
+    if (ref == INTERN_NONE) { if (u) nundo--; unlock(); return -1; }
+
+    chunk_t *c = CHUNK(idx);
+    size_t k = CIDX(idx);
+    jop_t op = { JOP_CREATE, VM_STATE_STOPPED, (uint8_t)nlen, c->id[k], mem_mib>0?mem_mib:512, name };
+    if (journal_op(&op) != 0) {
+        intern_drop(ref);
+        if (u) nundo--;
+        unlock();
+        return -1;
+    }
+    if (u) { u->op = idx == nslots ? UNDO_GROW : UNDO_CREATE; u->idx = (uint32_t)idx; }
+    if (idx == nslots) nslots++;
+    else free_head = c->next_free[k];
+    c->mem_mib[k] = mem_mib>0?mem_mib:512;
+    c->state[k] = VM_STATE_STOPPED;
+    c->name[k] = ref;
+    int id = c->id[k];
+    vcount++;
+    unlock();
+    LOGD(LOG_SYS_LIBVM, "created id=%d name=%.*s mem=%d\n", id, (int)nlen, name, mem_mib>0?mem_mib:512);
+    if (out_id) *out_id = id;
     return 0;
 }
 
 int vm_destroy(int id) {
-    int idx = find_index(id);
-    if (idx < 0) return -1;
-    // compact
-    for (size_t i=idx+1;i<vcount;i++) vms[i-1] = vms[i];
+    wrlock();
+    long idx = lookup(id);
+    if (idx < 0) { unlock(); return -1; }
+    chunk_t *c = CHUNK(idx);
+    size_t k = CIDX(idx);
+    undo_t *u = in_batch ? undo_push() : NULL;
+    if (in_batch && !u) { unlock(); return -1; }
+    jop_t op = { JOP_DESTROY, 0, 0, id, 0, "" };
+    if (journal_op(&op) != 0) {
+        if (u) nundo--;
+        unlock();
+        return -1;
+    }
+    if (u) {
+        *u = (undo_t){ UNDO_DESTROY, c->state[k], (uint32_t)idx, c->id[k], c->mem_mib[k], c->name[k] };
+    } else {
+        intern_drop(c->name[k]);
+    }
+    uint32_t gen = (((uint32_t)id >> SLOT_BITS) + 1) & GEN_MASK;
+    c->id[k] = (int32_t)((gen << SLOT_BITS) | (uint32_t)(idx + 1));
+    c->state[k] = STATE_FREE;
+    c->next_free[k] = free_head;
+    free_head = (int)idx;
     vcount--;
+    unlock();
+    LOGD(LOG_SYS_LIBVM, "destroyed id=%d\n", id);
     return 0;
 }
 
 int vm_info(int id, vm_t *out) {
-    int idx = find_index(id);
-    if (idx < 0) return -1;
-    if (out) *out = vms[idx];
+    rdlock();
+    long idx = lookup(id);
+    if (idx >= 0 && out) export_vm((size_t)idx, out);
+    unlock();
+    return idx < 0 ? -1 : 0;
+}
+
+int vm_mem_by_state(long long mem_out[VM_STATE_COUNT], size_t count_out[VM_STATE_COUNT]) {
+    long long mem[VM_STATE_COUNT] = {0};
+    size_t cnt[VM_STATE_COUNT] = {0};
+
+    rdlock();
+    for (size_t ch=0; ch<nchunks; ch++) {
+        const chunk_t *c = chunks[ch];
+        size_t n = nslots - ch * CHUNK_SLOTS;
+        if (n > CHUNK_SLOTS) n = CHUNK_SLOTS;
+        // branch-free per state so the compiler can vectorize each pass
+        for (int s=0; s<VM_STATE_COUNT; s++) {
+            long long m = 0;
+            size_t hits = 0;
+            for (size_t k=0; k<n; k++) {
+                int match = c->state[k] == s;
+                m += match ? c->mem_mib[k] : 0;
+                hits += (size_t)match;
+            }
+            mem[s] += m;
+            cnt[s] += hits;
+        }
+    }
+    unlock();
+
+    if (mem_out) memcpy(mem_out, mem, sizeof(mem));
+    if (count_out) memcpy(count_out, cnt, sizeof(cnt));
+    return 0;
+}
+
+int vm_batch_begin(void) {
+    if (in_batch) return -1;
+    pthread_rwlock_wrlock(&vlock);
+    in_batch = 1;
+    nundo = 0;
+    jbuf_len = jbuf_ops = 0;
+    return 0;
+}
+
+// Undo runs newest first, so every free-list push/pop is reversed in the
+// exact order it happened.
+static void batch_rollback(void) {
+    while (nundo > 0) {
+        const undo_t *u = &undo[--nundo];
+        chunk_t *c = CHUNK(u->idx);
+        size_t k = CIDX(u->idx);
+        if (u->op == UNDO_DESTROY) {
+            free_head = c->next_free[k];
+            c->id[k] = u->id;
+            c->mem_mib[k] = u->mem_mib;
+            c->state[k] = u->state;
+            c->name[k] = u->name;
+            vcount++;
+        } else {
+            intern_drop(c->name[k]);
+            c->state[k] = STATE_FREE;
+            if (u->op == UNDO_GROW) nslots--;
+            else free_head = (int)u->idx;
+            vcount--;
+        }
+    }
+}
+
+int vm_batch_end(int commit) {
+    if (!in_batch) return -1;
+    size_t undone = 0;
+    int rc = 0;
+    // the whole batch is one journal record: replayed entirely or not at all
+    if (commit && jbuf_ops) {
+        uint64_t lsn = journal_append(jbuf, jbuf_len, jbuf_ops);
+        if (lsn) {
+            last_lsn = lsn;
+        } else {
+            LOGW(LOG_SYS_LIBVM, "batch not journaled, rolling back\n");
+            commit = 0;
+            rc = -1;
+        }
+    }
+    jbuf_len = jbuf_ops = 0;
+    if (commit) {
+        for (size_t i=0;i<nundo;i++) if (undo[i].op == UNDO_DESTROY) intern_drop(undo[i].name);
+        nundo = 0;
+    } else {
+        undone = nundo;
+        batch_rollback();
+    }
+    in_batch = 0;
+    pthread_rwlock_unlock(&vlock);
+    if (!commit) LOGD(LOG_SYS_LIBVM, "batch rolled back (%zu changes undone)\n", undone);
+    return rc;
+}
+
+// ----- persistence -----
+
+// Next handle for a slot once id leaves it.
+static int32_t next_gen_id(int32_t id) {
+    uint32_t gen = (((uint32_t)id >> SLOT_BITS) + 1) & GEN_MASK;
+    return (int32_t)((gen << SLOT_BITS) | ((uint32_t)id & SLOT_MASK));
+}
+
+// Make slots up to idx exist; new ones are free at generation 0. caller
+// holds vlock exclusively
+static int restore_reach(size_t idx) {
+    while (nslots <= idx) {
+        if (grow_locked() != 0) return -1;
+        chunk_t *c = CHUNK(nslots);
+        c->id[CIDX(nslots)] = (int32_t)(nslots + 1);
+        c->state[CIDX(nslots)] = STATE_FREE;
+        nslots++;
+    }
+    return 0;
+}
+
+// Copy the mapped arrays chunk by chunk and intern the live names.
+// caller holds vlock exclusively on an empty store
+static int restore_snapshot(const jsnap_t *snap) {
+    if (snap->nslots > MAX_VMS) return -1;
+    for (size_t base = 0; base < snap->nslots; base += CHUNK_SLOTS) {
+        nslots = base;
+        if (grow_locked() != 0) return -1;
+        chunk_t *c = CHUNK(base);
+        size_t n = snap->nslots - base < CHUNK_SLOTS ? snap->nslots - base : CHUNK_SLOTS;
+        memcpy(c->id, snap->id + base, n * sizeof(c->id[0]));
+        memcpy(c->mem_mib, snap->mem_mib + base, n * sizeof(c->mem_mib[0]));
+        memcpy(c->state, snap->state + base, n);
+        for (size_t k=0;k<n;k++) {
+            size_t i = base + k;
+            if (((uint32_t)c->id[k] & SLOT_MASK) != i + 1) return -1;
+            if (c->state[k] == STATE_FREE) continue;
+            uint64_t off = snap->name_off[i];
+            if (c->state[k] >= VM_STATE_COUNT || off >= snap->names_len ||
+                off + 1 + (uint8_t)snap->names[off] > snap->names_len) return -1;
+            c->name[k] = intern_put(snap->names + off + 1, (uint8_t)snap->names[off]);
+            if (c->name[k] == INTERN_NONE) return -1;
+            vcount++;
+        }
+    }
+    nslots = snap->nslots;
+    return vcount == snap->nlive ? 0 : -1;
+}
+
+// Replay callback: apply one journaled op at exactly the slot and
+// generation it had. caller holds vlock exclusively
+static int restore_op(const jop_t *op, void *arg) {
+    (void)arg;
+    if (op->id <= 0 || ((uint32_t)op->id & SLOT_MASK) == 0) return -1;
+    size_t idx = ((uint32_t)op->id & SLOT_MASK) - 1;
+    if (op->op == JOP_CREATE) {
+        if (op->state >= VM_STATE_COUNT || restore_reach(idx) != 0) return -1;
+        chunk_t *c = CHUNK(idx);
+        size_t k = CIDX(idx);
+        if (c->state[k] != STATE_FREE) return -1;
+        uint32_t ref = intern_put(op->name, op->name_len);
+        if (ref == INTERN_NONE) return -1;
+        c->id[k] = op->id;
+        c->mem_mib[k] = op->mem_mib;
+        c->state[k] = op->state;
+        c->name[k] = ref;
+        vcount++;
+        return 0;
+    }
+    if (op->op == JOP_DESTROY) {
+        long at = lookup(op->id);
+        if (at < 0) return -1;
+        chunk_t *c = CHUNK(at);
+        size_t k = CIDX(at);
+        intern_drop(c->name[k]);
+        c->id[k] = next_gen_id(op->id);
+        c->state[k] = STATE_FREE;
+        vcount--;
+        return 0;
+    }
+    return -1;
+}
+
+// Lowest slots first, like a store that never freed anything out of order.
+// caller holds vlock exclusively
+static void rebuild_free_list(void) {
+    free_head = -1;
+    for (size_t i = nslots; i-- > 0; ) {
+        chunk_t *c = CHUNK(i);
+        if (c->state[CIDX(i)] != STATE_FREE) continue;
+        c->next_free[CIDX(i)] = free_head;
+        free_head = (int)i;
+    }
+}
+
+// The table as snapshot arrays in one allocation (*mem, freed by the
+// caller). caller holds vlock exclusively
+static int snapshot_image(jsnap_t *snap, uint64_t gen, void **mem) {
+    uint64_t names_len = 0;
+    for (size_t i=0;i<nslots;i++) {
+        const chunk_t *c = CHUNK(i);
+        if (c->state[CIDX(i)] != STATE_FREE) names_len += 1 + intern_len(c->name[CIDX(i)]);
+    }
+    if (names_len > UINT32_MAX) return -1;
+    size_t n = nslots;
+    char *p = malloc(n * (4 + 4 + 1 + 4) + (size_t)names_len + 1);
+    if (!p) return -1;
+    int32_t  *id = (int32_t *)p;
+    int32_t  *mm = id + n;
+    uint32_t *no = (uint32_t *)(mm + n);
+    uint8_t  *st = (uint8_t *)(no + n);
+    char     *names = (char *)(st + n);
+
+    uint32_t at = 0;
+    for (size_t ch=0; ch<nchunks && ch * CHUNK_SLOTS < n; ch++) {
+        const chunk_t *c = chunks[ch];
+        size_t base = ch * CHUNK_SLOTS;
+        size_t cnt = n - base < CHUNK_SLOTS ? n - base : CHUNK_SLOTS;
+        memcpy(id + base, c->id, cnt * sizeof(id[0]));
+        memcpy(mm + base, c->mem_mib, cnt * sizeof(mm[0]));
+        memcpy(st + base, c->state, cnt);
+        for (size_t k=0;k<cnt;k++) {
+            no[base + k] = 0;
+            if (c->state[k] == STATE_FREE) continue;
+            size_t len = intern_len(c->name[k]);
+            no[base + k] = at;
+            names[at] = (char)len;
+            memcpy(names + at + 1, intern_str(c->name[k]), len);
+            at += (uint32_t)(1 + len);
+        }
+    }
+    *snap = (jsnap_t){ gen, n, vcount, id, mm, st, no, names, names_len };
+    *mem = p;
+    return 0;
+}
+
+// The table is held only for the journal rotation and an in-memory copy;
+// the snapshot file is written after writers are let back in.
+int vm_persist_compact(void) {
+    if (!persisting || in_batch) return -1;
+    pthread_mutex_lock(&compact_mu);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    jsnap_t snap;
+    void *mem = NULL;
+    uint64_t gen, ops;
+    pthread_rwlock_wrlock(&vlock);
+    ops = journal_ops();
+    int rc = journal_rotate(&gen);
+    if (rc == 0) rc = snapshot_image(&snap, gen, &mem);
+    pthread_rwlock_unlock(&vlock);
+    if (rc == 0) rc = journal_write_snapshot(&snap);
+    free(mem);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_mutex_unlock(&compact_mu);
+    if (rc == 0) {
+        LOGI(LOG_SYS_LIBVM, "compacted %llu journal ops into snapshot gen %llu (%llu vms) in %.1f ms\n",
+             (unsigned long long)ops, (unsigned long long)gen, (unsigned long long)snap.nlive,
+             (double)(t1.tv_sec - t0.tv_sec) * 1e3 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e6);
+    } else {
+        LOGE(LOG_SYS_LIBVM, "compaction failed; the journal keeps growing\n");
+    }
+    return rc;
+}
+
+static void *compactor_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&wake_mu);
+    while (!compactor_stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        pthread_cond_timedwait(&wake_cv, &wake_mu, &ts);
+        if (compactor_stop) break;
+        pthread_mutex_unlock(&wake_mu);
+        pthread_rwlock_rdlock(&vlock);
+        uint64_t ops = journal_ops();
+        size_t live = vcount;
+        pthread_rwlock_unlock(&vlock);
+        if (ops >= COMPACT_MIN_OPS && ops > live) vm_persist_compact();
+        pthread_mutex_lock(&wake_mu);
+    }
+    pthread_mutex_unlock(&wake_mu);
+    return NULL;
+}
+
+int vm_persist_open(const char *dir, unsigned commit_window_us) {
+    if (persisting || journal_open(dir) != 0) return -1;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    pthread_rwlock_wrlock(&vlock);
+    jsnap_t snap;
+    long ops = -1;
+    int have = nslots == 0 ? journal_map_snapshot(&snap) : -1;
+    uint64_t gen = have > 0 ? snap.gen : 0;
+    if (have == 0 || (have > 0 && restore_snapshot(&snap) == 0)) {
+        journal_unmap_snapshot(&snap);
+        ops = journal_replay(gen, restore_op, NULL);
+    } else if (have > 0) {
+        LOGE(LOG_SYS_LIBVM, "%s/snapshot: inconsistent contents\n", dir);
+        journal_unmap_snapshot(&snap);
+    }
+    if (ops >= 0 && journal_start(commit_window_us) != 0) ops = -1;
+    if (ops >= 0) {
+        rebuild_free_list();
+        persisting = 1;
+    } else {
+        reset_locked();
+        intern_init();
+    }
+    size_t live = vcount;
+    pthread_rwlock_unlock(&vlock);
+    if (ops < 0) {
+        LOGE(LOG_SYS_LIBVM, "cannot restore the store from %s\n", dir);
+        journal_close();
+        return -1;
+    }
+
+    compactor_stop = 0;
+    if (pthread_create(&compactor, NULL, compactor_main, NULL) != 0) {
+        LOGW(LOG_SYS_LIBVM, "no compactor thread; compacting only at shutdown\n");
+        compactor_stop = -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    LOGI(LOG_SYS_LIBVM, "restored %zu vms from %s (snapshot gen %llu + %ld journal ops) in %.1f ms\n",
+         live, dir, (unsigned long long)gen, ops,
+         (double)(t1.tv_sec - t0.tv_sec) * 1e3 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e6);
+    return 0;
+}
+
+// Stop the compactor, fold the journal into a last snapshot so the next
+// start replays nothing, and close the files.
+static void persist_stop(void) {
+    if (compactor_stop == 0) {
+        pthread_mutex_lock(&wake_mu);
+        compactor_stop = 1;
+        pthread_cond_signal(&wake_cv);
+        pthread_mutex_unlock(&wake_mu);
+        pthread_join(compactor, NULL);
+    }
+    if (journal_ops() > 0) vm_persist_compact();
+    pthread_rwlock_wrlock(&vlock);
+    persisting = 0;
+    journal_close();
+    pthread_rwlock_unlock(&vlock);
+}
+
+unsigned long long vm_persist_last(void) { return last_lsn; }
+
+int vm_persist_synced(unsigned long long seq) {
+    return persisting ? journal_synced(seq) : 1;
+}
+
+int vm_persist_notify(int fd, int on) {
+    return persisting ? journal_notify(fd, on) : -1;
+}
+
+int vm_persist_stats(vm_persist_stats_t *out) {
+    if (!persisting) return -1;
+    journal_stats(out);
     return 0;
 }
@@ -1,37 +1,279 @@
 // log.c - tiny logger
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "log.h"
 
 FILE *g_logfp = NULL;
 
+// Serializes writers so lines from different workers never interleave,
+// and guards g_logfp against log_close() racing a late log_msg().
+static pthread_mutex_t g_loglock = PTHREAD_MUTEX_INITIALIZER;
+
+// ----- async mode -----
+// Producers format the message body into a slot of a bounded lock-free
+// ring (Vyukov's sequence-numbered queue; many producers, the flusher as
+// the only consumer) and return. The flusher thread adds timestamps,
+// writes whole batches with one fwrite and flushes once per batch, so a
+// slow log device never stalls a worker.
+
+#define LOG_RING     4096           // records; power of two
+#define LOG_MSG_MAX  256            // longer messages are cut short
+#define LOG_IDLE_MS  100            // flusher nap when the ring is empty
+
+typedef struct {
+    size_t   seq;       // == position: free for that producer; position+1: filled
+    time_t   t;
+    uint32_t len;
+    char     msg[LOG_MSG_MAX];
+} log_cell_t;
+
+static log_cell_t *ring;
+static size_t enq_pos __attribute__((aligned(64)));     // shared by producers
+static size_t deq_pos __attribute__((aligned(64)));     // flusher only
+static int    async_on;
+static log_full_t full_policy;
+static time_t now_sec;                  // refreshed by the flusher, read by producers
+static unsigned long long dropped;      // records lost to a full ring (LOG_FULL_DROP)
+
+static pthread_t       flusher;
+static int             flusher_stop;
+static int             flusher_idle;
+static pthread_mutex_t wake_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  wake_cv = PTHREAD_COND_INITIALIZER;
+
+static log_cell_t *ring_claim(size_t *pos_out) {
+    size_t pos = __atomic_load_n(&enq_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        log_cell_t *c = &ring[pos & (LOG_RING-1)];
+        size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&enq_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos_out = pos;
+                return c;
+            }
+        } else if (dif < 0) {
+            return NULL;        // full: the flusher has not freed this slot yet
+        } else {
+            pos = __atomic_load_n(&enq_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void flusher_wake(void) {
+    if (!__atomic_load_n(&flusher_idle, __ATOMIC_ACQUIRE)) return;
+    pthread_mutex_lock(&wake_mu);
+    pthread_cond_signal(&wake_cv);
+    pthread_mutex_unlock(&wake_mu);
+}
+
+// tag goes in front of the formatted message ("" for plain log_msg)
+static void log_async(const char *tag, const char *fmt, va_list ap) {
+    size_t pos;
+    log_cell_t *c;
+    while (!(c = ring_claim(&pos))) {
+        if (full_policy == LOG_FULL_DROP) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        flusher_wake();
+        sched_yield();
+    }
+    time_t t = __atomic_load_n(&now_sec, __ATOMIC_RELAXED);
+    c->t = t ? t : time(NULL);
+    int n = snprintf(c->msg, sizeof(c->msg), "%s", tag);
+    int k = vsnprintf(c->msg + n, sizeof(c->msg) - (size_t)n, fmt, ap);
+    n += k > 0 ? k : 0;
+    if ((size_t)n >= sizeof(c->msg)) {
+        n = (int)sizeof(c->msg) - 1;
+        c->msg[n-1] = '\n';
+    }
+    c->len = (uint32_t)n;
+    __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+    flusher_wake();
+}
+
+static void *flusher_main(void *arg) {
+    (void)arg;
+    static char out[64 * 1024];
+    time_t ts_sec = (time_t)-1;
+    char ts[40];
+    int tslen = 0;
+
+    for (;;) {
+        __atomic_store_n(&now_sec, time(NULL), __ATOMIC_RELAXED);
+        int stop = __atomic_load_n(&flusher_stop, __ATOMIC_ACQUIRE);
+        size_t n = 0, drained = 0;
+        for (;;) {
+            log_cell_t *c = &ring[deq_pos & (LOG_RING-1)];
+            if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != deq_pos + 1) break;
+            if (c->t != ts_sec) {       // one strftime per second of log, not per line
+                struct tm tm;
+                localtime_r(&c->t, &tm);
+                char buf[32];
+                strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+                tslen = snprintf(ts, sizeof(ts), "[%s] ", buf);
+                ts_sec = c->t;
+            }
+            if (sizeof(out) - n < (size_t)tslen + c->len) {
+                fwrite(out, 1, n, g_logfp);
+                n = 0;
+            }
+            memcpy(out + n, ts, (size_t)tslen);
+            memcpy(out + n + tslen, c->msg, c->len);
+            n += (size_t)tslen + c->len;
+            __atomic_store_n(&c->seq, deq_pos + LOG_RING, __ATOMIC_RELEASE);
+            deq_pos++;
+            drained++;
+        }
+        unsigned long long lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+        if (n) fwrite(out, 1, n, g_logfp);
+        if (lost) fprintf(g_logfp, "%slog: ring full, dropped %llu messages\n", ts, lost);
+        if (n || lost) fflush(g_logfp);
+        if (drained) continue;
+        if (stop) break;
+
+        // nothing to do: nap until a producer wakes us or the clock ticks
+        pthread_mutex_lock(&wake_mu);
+        __atomic_store_n(&flusher_idle, 1, __ATOMIC_RELEASE);
+        struct timespec dl;
+        clock_gettime(CLOCK_REALTIME, &dl);
+        dl.tv_nsec += LOG_IDLE_MS * 1000000L;
+        if (dl.tv_nsec >= 1000000000L) { dl.tv_sec++; dl.tv_nsec -= 1000000000L; }
+        if (!__atomic_load_n(&flusher_stop, __ATOMIC_ACQUIRE))
+            pthread_cond_timedwait(&wake_cv, &wake_mu, &dl);
+        __atomic_store_n(&flusher_idle, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&wake_mu);
+    }
+    return NULL;
+}
+
+int log_start_async(log_full_t policy) {
+    pthread_mutex_lock(&g_loglock);
+    if (async_on) { pthread_mutex_unlock(&g_loglock); return 0; }
+    if (!g_logfp) g_logfp = stderr;
+    ring = malloc(LOG_RING * sizeof(*ring));
+    if (!ring) { pthread_mutex_unlock(&g_loglock); return -1; }
+    for (size_t i=0;i<LOG_RING;i++) ring[i].seq = i;
+    enq_pos = deq_pos = 0;
+    full_policy = policy;
+    flusher_stop = 0;
+    if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0) {
+        free(ring);
+        ring = NULL;
+        pthread_mutex_unlock(&g_loglock);
+        return -1;
+    }
+    __atomic_store_n(&async_on, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_loglock);
+    return 0;
+}
+
+// Drains everything queued so far; messages logged after this go out
+// synchronously. Call once the workers are gone.
+static void log_stop_async(void) {
+    __atomic_store_n(&async_on, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&wake_mu);
+    __atomic_store_n(&flusher_stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&wake_cv);
+    pthread_mutex_unlock(&wake_mu);
+    pthread_join(flusher, NULL);
+    free(ring);
+    ring = NULL;
+}
+
 void log_init(const char *path, int foreground) {
+    pthread_mutex_lock(&g_loglock);
     if (foreground) {
         g_logfp = stderr;
     } else {
         g_logfp = fopen(path ? path : "/tmp/hostd.log", "a");
         if (!g_logfp) g_logfp = stderr;
     }
+    pthread_mutex_unlock(&g_loglock);
 }
 
 void log_close(void) {
+    if (async_on) log_stop_async();
+    pthread_mutex_lock(&g_loglock);
     if (g_logfp && g_logfp != stderr) fclose(g_logfp);
     g_logfp = NULL;
+    pthread_mutex_unlock(&g_loglock);
 }
 
-void log_msg(const char *fmt, ...) {
-    if (!g_logfp) g_logfp = stderr;
+static void log_emit(const char *tag, const char *fmt, va_list ap) {
+    if (__atomic_load_n(&async_on, __ATOMIC_ACQUIRE)) {
+        log_async(tag, fmt, ap);
+        return;
+    }
+
     time_t t = time(NULL);
     struct tm tm; localtime_r(&t, &tm);
     char ts[32];
     strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
-    fprintf(g_logfp, "[%s] ", ts);
+
+    pthread_mutex_lock(&g_loglock);
+    if (!g_logfp) g_logfp = stderr;
+    fprintf(g_logfp, "[%s] %s", ts, tag);
+    vfprintf(g_logfp, fmt, ap);
+    fflush(g_logfp);
+    pthread_mutex_unlock(&g_loglock);
+}
+
+void log_msg(const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    vfprintf(g_logfp, fmt, ap);
+    log_emit("", fmt, ap);
+    va_end(ap);
+}
+
+// ----- levels and subsystems -----
+
+unsigned char g_log_level[LOG_NSYS] = { LOG_LVL_INFO, LOG_LVL_INFO, LOG_LVL_INFO };
+
+static const char *const level_names[LOG_NLEVELS] = { "error", "warn", "info", "debug", "trace" };
+static const char *const sys_names[LOG_NSYS] = { "server", "protocol", "libvm" };
+
+const char *log_level_name(int level) {
+    return (unsigned)level < LOG_NLEVELS ? level_names[level] : "?";
+}
+
+const char *log_sys_name(int sys) {
+    return (unsigned)sys < LOG_NSYS ? sys_names[sys] : "?";
+}
+
+static int name_index(const char *const *names, int n, const char *s, size_t len) {
+    for (int i=0;i<n;i++) {
+        if (strlen(names[i]) == len && strncasecmp(names[i], s, len) == 0) return i;
+    }
+    return -1;
+}
+
+int log_level_parse(const char *s, size_t len) { return name_index(level_names, LOG_NLEVELS, s, len); }
+int log_sys_parse(const char *s, size_t len)   { return name_index(sys_names, LOG_NSYS, s, len); }
+
+void log_set_level(int sys, int level) {
+    if (level < 0) level = 0;
+    if (level >= LOG_NLEVELS) level = LOG_NLEVELS - 1;
+    for (int i=0;i<LOG_NSYS;i++) {
+        if (sys < 0 || sys == i) __atomic_store_n(&g_log_level[i], (unsigned char)level, __ATOMIC_RELAXED);
+    }
+}
+
+void log_write(log_sys_t sys, int level, const char *fmt, ...) {
+    char tag[32];
+    snprintf(tag, sizeof(tag), "%s %s: ", log_level_name(level), log_sys_name(sys));
+    va_list ap;
+    va_start(ap, fmt);
+    log_emit(tag, fmt, ap);
     va_end(ap);
-    fflush(g_logfp);
 }
@@ -4,129 +4,961 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "protocol.h"
+#include "proto_bin.h"
 #include "libvm.h"
 #include "hostd.h"
 #include "log.h"
+#include "stats.h"
 #include "version.h"
 
-static int ok(char *out, size_t outsz, const char *fmt, ...) {
+// ----- replies -----
+// Handlers answer through these, so one handler serves both framings:
+// text lines ("200 OK ...\n") or binary frames laid out in proto_bin.h.
+
+#define FRAME_HDR 6     // u32 len | u8 status | u8 type
+
+static size_t frame_open(char *out, int status, int type) {
+    out[4] = (char)status;
+    out[5] = (char)type;
+    return FRAME_HDR;
+}
+
+static int frame_close(char *out, size_t n) {
+    pb_put32((unsigned char *)out, (uint32_t)(n - 4));
+    return (int)n;
+}
+
+static int reply_msg(proto_session_t *s, char *out, size_t outsz, int failed, const char *fmt, va_list ap) {
+    if (failed) s->failed = 1;
+    if (s->binary) {
+        size_t n = frame_open(out, failed ? PB_ERR : PB_OK, PB_T_MSG);
+        int k = vsnprintf(out+n, outsz-n, fmt, ap);
+        if (k > 0) n += (size_t)k < outsz-n ? (size_t)k : outsz-n-1;
+        return frame_close(out, n);
+    }
+    int n = snprintf(out, outsz, failed ? "400 ERR " : "200 OK ");
+    n += vsnprintf(out+n, outsz-n, fmt, ap);
+    if ((size_t)n < outsz-1) { out[n++] = '\n'; out[n] = 0; }
+    return n;
+}
+
+static int ok(proto_session_t *s, char *out, size_t outsz, const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    int n = snprintf(out, outsz, "200 OK ");
-    n += vsnprintf(out+n, outsz-n, fmt, ap);
+    int n = reply_msg(s, out, outsz, 0, fmt, ap);
     va_end(ap);
-    if ((size_t)n < outsz-1) { out[n++] = '\n'; out[n] = 0; }
     return n;
 }
 
-static int err(char *out, size_t outsz, const char *fmt, ...) {
+static int err(proto_session_t *s, char *out, size_t outsz, const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    int n = snprintf(out, outsz, "400 ERR ");
-    n += vsnprintf(out+n, outsz-n, fmt, ap);
+    int n = reply_msg(s, out, outsz, 1, fmt, ap);
     va_end(ap);
-    if ((size_t)n < outsz-1) { out[n++] = '\n'; out[n] = 0; }
     return n;
 }
 
-// simple kv parser: key=val tokens, whitespace separated
-static const char* kv_get(const char *key, char *copy, size_t copy_sz) {
-    (void)copy_sz;  // silence unused parameter
-    // search token "key=" in copy
-    size_t keylen = strlen(key);
-    char *p = copy;
-    while (p && *p) {
-        while (isspace((unsigned char)*p)) p++;
-        if (!*p) break;
-        char *end = p;
-        while (*end && !isspace((unsigned char)*end)) end++;
-        char save = *end; *end = 0;
-        if (strncmp(p, key, keylen)==0 && p[keylen]=='=') {
-            char *val = p + keylen + 1;
-            // strip quotes if present
-            if (*val=='\"') {
-                val++;
-                char *q = strrchr(val, '\"');
-                if (q) *q=0;
+int protocol_error(proto_session_t *s, char *out, size_t outsz, const char *msg) {
+    return err(s, out, outsz, "%s", msg);
+}
+
+static int reply_id(proto_session_t *s, char *out, size_t outsz, int id) {
+    if (!s->binary) return ok(s, out, outsz, "id=%d", id);
+    size_t n = frame_open(out, PB_OK, PB_T_ID);
+    pb_put32((unsigned char *)out + n, (uint32_t)id);
+    return frame_close(out, n + 4);
+}
+
+// Fixed-layout record; the name is zero-padded so every byte is defined.
+static void put_vm(char *dst, const vm_t *v) {
+    unsigned char *p = (unsigned char *)dst;
+    size_t nlen = strnlen(v->name, PB_VM_NAME);
+    pb_put32(p, (uint32_t)v->id);
+    pb_put32(p + 4, (uint32_t)v->mem_mib);
+    p[8] = (unsigned char)v->state_code;
+    p[9] = (unsigned char)nlen;
+    memcpy(p + 10, v->name, nlen);
+    memset(p + 10 + nlen, 0, PB_VM_NAME - nlen);
+}
+
+static int reply_vm(proto_session_t *s, char *out, size_t outsz, const vm_t *v) {
+    if (!s->binary)
+        return ok(s, out, outsz, "id=%d name=%s mem=%d state=%s", v->id, v->name, v->mem_mib, v->state);
+    size_t n = frame_open(out, PB_OK, PB_T_VM);
+    put_vm(out + n, v);
+    return frame_close(out, n + PB_VM_SIZE);
+}
+
+// ----- tokenizer -----
+// One pass over the line; every span points into the caller's buffer.
+
+static int is_blank(char c) { return c==' ' || c=='\t' || c=='\r' || c=='\n'; }
+
+int proto_tokenize(const char *line, size_t len, proto_req_t *req) {
+    const char *p = line, *end = line + len;
+    memset(req, 0, sizeof(*req));
+
+    while (p < end && is_blank(*p)) p++;
+    req->verb.p = p;
+    while (p < end && !is_blank(*p)) p++;
+    req->verb.len = (size_t)(p - req->verb.p);
+    while (p < end && is_blank(*p)) p++;
+    req->rest.p = p;
+    req->rest.len = (size_t)(end - p);
+
+    while (p < end) {
+        proto_kv_t kv = {0};
+        const char *tok = p;
+        while (p < end && !is_blank(*p) && *p != '=' && *p != '"') p++;
+        if (p < end && *p == '=') {
+            kv.key.p = tok;
+            kv.key.len = (size_t)(p - tok);
+            p++;
+        } else {
+            p = tok;                // positional argument
+        }
+        if (p < end && *p == '"') {
+            // quoted: runs to the next unescaped quote, blanks included
+            kv.val.p = ++p;
+            while (p < end && *p != '"') {
+                if (*p == '\\' && p + 1 < end) { kv.escaped = 1; p++; }
+                p++;
             }
-            return val;
+            if (p == end) return -1;    // unterminated quote
+            kv.val.len = (size_t)(p - kv.val.p);
+            p++;
+            if (p < end && !is_blank(*p)) return -1;
+        } else {
+            kv.val.p = p;
+            while (p < end && !is_blank(*p)) p++;
+            kv.val.len = (size_t)(p - kv.val.p);
         }
-        *end = save;
-        p = end;
+        if (req->nkv == PROTO_MAX_ARGS) return -1;
+        req->kv[req->nkv++] = kv;
+        while (p < end && is_blank(*p)) p++;
+    }
+    return 0;
+}
+
+const proto_kv_t *proto_arg(const proto_req_t *req, const char *key) {
+    size_t klen = strlen(key);
+    for (size_t i=0;i<req->nkv;i++) {
+        const proto_kv_t *kv = &req->kv[i];
+        if (kv->key.len == klen && memcmp(kv->key.p, key, klen) == 0) return kv;
     }
     return NULL;
 }
 
-int protocol_handle_line(const char *line, char *outbuf, size_t outsz) {
-    // make a writable copy
-    char tmp[1024];
-    strncpy(tmp, line, sizeof(tmp)-1);
-    tmp[sizeof(tmp)-1] = 0;
-
-    // uppercase command word
-    char *cmd = tmp;
-    while (*cmd && isspace((unsigned char)*cmd)) cmd++;
-    char *sp = cmd;
-    while (*sp && !isspace((unsigned char)*sp)) { *sp = toupper((unsigned char)*sp); sp++; }
-    char *rest = sp;
-    while (*rest && isspace((unsigned char)*rest)) rest++;
-
-    if (strcmp(cmd, "PING")==0) {
-        return ok(outbuf, outsz, "PONG");
-    } else if (strcmp(cmd, "VERSION")==0) {
-        return ok(outbuf, outsz, "hostd " HOSTD_VERSION);
-    } else if (strcmp(cmd, "HEALTH")==0) {
-        return ok(outbuf, outsz, "healthy");
-    } else if (strcmp(cmd, "ECHO")==0) {
-        return ok(outbuf, outsz, "%s", rest);
-    } else if (strcmp(cmd, "SHUTDOWN")==0) {
-        g_running = 0;
-        return ok(outbuf, outsz, "bye");
-    } else if (strcmp(cmd, "VM.LIST")==0) {
-        size_t count=0;
-        vm_list(NULL, 0, &count);
-        if (count==0) return ok(outbuf, outsz, "0 vms");
-        // else list them
-        vm_t arr[64];
-        if (count > 64) count = 64;
-        size_t got=0; vm_list(arr, count, &got);
-        int n = snprintf(outbuf, outsz, "200 OK %zu vms", got);
-        for (size_t i=0;i<got;i++) {
-            n += snprintf(outbuf+n, outsz-n, " | id=%d name=%s mem=%d state=%s",
-                          arr[i].id, arr[i].name, arr[i].mem_mib, arr[i].state);
+// Decimal value of a span; -1 if it is not a whole number in int range.
+static int span_int(proto_span_t s, int *out) {
+    if (s.len == 0 || s.len > 10) return -1;
+    long long v = 0;
+    size_t i = 0;
+    int neg = 0;
+    if (s.p[0] == '-' || s.p[0] == '+') { neg = s.p[0] == '-'; i++; }
+    if (i == s.len) return -1;
+    for (; i<s.len; i++) {
+        if (s.p[i] < '0' || s.p[i] > '9') return -1;
+        v = v * 10 + (s.p[i] - '0');
+    }
+    if (neg) v = -v;
+    if (v < INT32_MIN || v > INT32_MAX) return -1;
+    *out = (int)v;
+    return 0;
+}
+
+// NUL-terminated copy of a value, undoing \" and \\ escapes. Only needed
+// where a callee wants a C string (names handed to libvm).
+static void kv_copy(const proto_kv_t *kv, char *dst, size_t dstsz) {
+    size_t n = 0;
+    for (size_t i=0; i<kv->val.len && n+1<dstsz; i++) {
+        char c = kv->val.p[i];
+        if (kv->escaped && c == '\\' && i + 1 < kv->val.len) c = kv->val.p[++i];
+        dst[n++] = c;
+    }
+    dst[n] = 0;
+}
+
+// ----- command handlers -----
+
+static int cmd_ping(proto_session_t *s, const proto_req_t *req, char *out, size_t outsz) {
+    (void)req;
+    return ok(s, out, outsz, "PONG");
+}
+
+static int cmd_version(proto_session_t *s, const proto_req_t *req, char *out, size_t outsz) {
+    (void)req;
+    return ok(s, out, outsz, "hostd " HOSTD_VERSION);
+}
+
+static int cmd_health(proto_session_t *s, const proto_req_t *req, char *out, size_t outsz) {
+    (void)req;
+    return ok(s, out, outsz, "healthy");
+}
+
+static int cmd_echo(proto_session_t *s, const proto_req_t *req, char *out, size_t outsz) {
+    return ok(s, out, outsz, "%.*s", (int)req->rest.len, req->rest.p);
+}
+
+static int cmd_shutdown(proto_session_t *s, const proto_req_t *req, char *out, size_t outsz) {
+    (void)req;
+    g_running = 0;
+    return ok(s, out, outsz, "bye");
+}
+
+// LOG.LEVEL                          show every subsystem's level
+// LOG.LEVEL debug                    set all of them
+// LOG.LEVEL server=trace libvm=warn  set some
+static int cmd_log_level(proto_session_t *s, const proto_req_t *req, char *out, size_t outsz) {
+    int lv[LOG_NSYS];
+    for (int k=0;k<LOG_NSYS;k++) lv[k] = __atomic_load_n(&g_log_level[k], __ATOMIC_RELAXED);
+    // validate everything before changing anything
+    for (size_t i=0;i<req->nkv;i++) {
+        const proto_kv_t *kv = &req->kv[i];
+        int level = log_level_parse(kv->val.p, kv->val.len);
+        if (level < 0) return err(s, out, outsz, "unknown level %.*s", (int)kv->val.len, kv->val.p);
+        if (level > LOG_COMPILE_LEVEL) return err(s, out, outsz, "level %s compiled out", log_level_name(level));
+        if (kv->key.len == 0) {
+            for (int k=0;k<LOG_NSYS;k++) lv[k] = level;
+            continue;
+        }
+        int sys = log_sys_parse(kv->key.p, kv->key.len);
+        if (sys < 0) return err(s, out, outsz, "unknown subsystem %.*s", (int)kv->key.len, kv->key.p);
+        lv[sys] = level;
+    }
+    for (int k=0;k<LOG_NSYS;k++) log_set_level(k, lv[k]);
+
+    char msg[128];
+    size_t n = 0;
+    for (int k=0;k<LOG_NSYS;k++)
+        n += (size_t)snprintf(msg+n, sizeof(msg)-n, "%s%s=%s", k ? " " : "", log_sys_name(k), log_level_name(lv[k]));
+    return ok(s, out, outsz, "%s", msg);
+}
+
+// Answered in the framing the request came in; the switch applies after.
+static int cmd_proto(proto_session_t *s, const proto_req_t *req, char *out, size_t outsz) {
+    if (s->in_batch) return err(s, out, outsz, "PROTO not allowed in BATCH");
+    const proto_kv_t *kv = req->nkv ? &req->kv[0] : NULL;
+    int bin;
+    if (kv && kv->val.len == 6 && strncasecmp(kv->val.p, "binary", 6) == 0) bin = 1;
+    else if (kv && kv->val.len == 4 && strncasecmp(kv->val.p, "text", 4) == 0) bin = 0;
+    else return err(s, out, outsz, "expected PROTO binary|text");
+    int n = ok(s, out, outsz, "%s", bin ? "binary" : "text");
+    s->binary = bin;
+    return n;
+}
+
+// ----- VM.LIST -----
+// Records come out of libvm a batch at a time and are formatted straight
+// into the caller's buffer, so a listing of any size holds one batch in
+// memory and starts going out before the walk is finished.
+//   VM.LIST                     one line: "200 OK N vms | id=... | ..."
+//   VM.LIST limit=N [cursor=X]  one page of that line, with next=<cursor> (0: end)
+//   VM.LIST stream=1            "VM id=..." per line, then "200 OK end count=N"
+// In binary mode every form is PB_T_VMS frames closed by a PB_T_END frame.
+
+#define LIST_BATCH     64
+#define LIST_LIMIT_MAX 1000
+#define LIST_REC_MAX   192      // one formatted record, 63-byte name included
+
+enum { LIST_LINE, LIST_LINES, LIST_BIN, STREAM_BUF };
+
+struct proto_stream {
+    int    mode;        // LIST_LINE: " | rec" items, then "\n"; LIST_LINES: "VM rec\n", then a summary;
+                        // STREAM_BUF: a prepared reply in buf (BATCH, STATS)
+    char  *buf;
+    size_t blen, boff;
+    int    paged;       // limit= given: the whole page is already in batch
+    int    more;        // libvm has VMs past cursor
+    size_t cursor;      // libvm cursor of the next batch
+    size_t left;        // records still to send
+    size_t sent;
+    size_t n, i;        // batch fill and read position
+    size_t stat_slot;   // stats slot + 1 credited with the streamed bytes; 0: none
+    vm_t   batch[];
+};
+
+static void stream_end(proto_session_t *s) {
+    if (s->stream) free(s->stream->buf);
+    free(s->stream);
+    s->stream = NULL;
+}
+
+// Next record to send, refilling the batch as needed; NULL at the end.
+static const vm_t *list_peek(proto_stream_t *st) {
+    if (st->i == st->n) {
+        if (st->paged || !st->more || st->left == 0) return NULL;
+        size_t want = st->left < LIST_BATCH ? st->left : LIST_BATCH;
+        st->more = vm_list_from(&st->cursor, st->batch, want, &st->n);
+        st->i = 0;
+        if (st->n == 0) return NULL;
+    }
+    return &st->batch[st->i];
+}
+
+static void list_advance(proto_stream_t *st) {
+    st->i++;
+    st->sent++;
+    st->left--;
+}
+
+static size_t list_next_cursor(const proto_stream_t *st) {
+    return st->paged && st->more ? st->cursor : 0;
+}
+
+// One or more PB_T_VMS frames, then the PB_T_END frame once there is room.
+static int list_fill_bin(proto_stream_t *st, char *out, size_t outsz, int *done) {
+    size_t n = 0;
+    const vm_t *v;
+    while ((v = list_peek(st)) && outsz - n >= FRAME_HDR + 2 + PB_VM_SIZE) {
+        char *f = out + n;
+        size_t fn = frame_open(f, PB_OK, PB_T_VMS) + 2;
+        uint16_t cnt = 0;
+        while (v && outsz - n - fn >= PB_VM_SIZE) {
+            put_vm(f + fn, v);
+            fn += PB_VM_SIZE;
+            cnt++;
+            list_advance(st);
+            v = list_peek(st);
+        }
+        pb_put16((unsigned char *)f + FRAME_HDR, cnt);
+        n += (size_t)frame_close(f, fn);
+    }
+    if (v || outsz - n < FRAME_HDR + 8) return (int)n;
+    char *f = out + n;
+    size_t fn = frame_open(f, PB_OK, PB_T_END);
+    pb_put32((unsigned char *)f + fn, (uint32_t)st->sent);
+    pb_put32((unsigned char *)f + fn + 4, (uint32_t)list_next_cursor(st));
+    n += (size_t)frame_close(f, fn + 8);
+    *done = 1;
+    return (int)n;
+}
+
+// Format as much of the listing as fits; sets *done once the last line is out.
+static int list_fill(proto_stream_t *st, char *out, size_t outsz, int *done) {
+    *done = 0;
+    if (st->mode == LIST_BIN) return list_fill_bin(st, out, outsz, done);
+    size_t n = 0;
+    const vm_t *v;
+    while ((v = list_peek(st))) {
+        if (outsz - n < LIST_REC_MAX) return (int)n;
+        n += (size_t)snprintf(out+n, outsz-n, st->mode == LIST_LINE
+                                  ? " | id=%d name=%s mem=%d state=%s"
+                                  : "VM id=%d name=%s mem=%d state=%s\n",
+                              v->id, v->name, v->mem_mib, v->state);
+        list_advance(st);
+    }
+    if (outsz - n < LIST_REC_MAX) return (int)n;
+    if (st->mode == LIST_LINES) {
+        n += (size_t)snprintf(out+n, outsz-n, "200 OK end count=%zu", st->sent);
+        if (st->paged) n += (size_t)snprintf(out+n, outsz-n, " next=%zu", list_next_cursor(st));
+    }
+    out[n++] = '\n';
+    out[n] = 0;
+    *done = 1;
+    return (int)n;
+}
+
+static int cmd_vm_list(proto_session_t *s, const proto_req_t *req, char *outbuf, size_t outsz) {
+    const proto_kv_t *kv;
+    int limit = 0, cursor = 0, stream = 0;
+    if ((kv = proto_arg(req, "limit")) &&
+        (span_int(kv->val, &limit) != 0 || limit < 1 || limit > LIST_LIMIT_MAX))
+        return err(s, outbuf, outsz, "bad limit= (1..%d)", LIST_LIMIT_MAX);
+    if ((kv = proto_arg(req, "cursor")) && (span_int(kv->val, &cursor) != 0 || cursor < 0))
+        return err(s, outbuf, outsz, "bad cursor=");
+    if ((kv = proto_arg(req, "stream")) && (span_int(kv->val, &stream) != 0 || stream < 0 || stream > 1))
+        return err(s, outbuf, outsz, "bad stream=");
+
+    size_t cap = limit ? (size_t)limit : LIST_BATCH;
+    proto_stream_t *st = malloc(sizeof(*st) + cap * sizeof(vm_t));
+    if (!st) return err(s, outbuf, outsz, "out of memory");
+    memset(st, 0, sizeof(*st));
+    st->mode = s->binary ? LIST_BIN : stream ? LIST_LINES : LIST_LINE;
+    st->cursor = (size_t)cursor;
+    st->more = 1;
+    st->left = SIZE_MAX;
+
+    int n = 0;
+    if (limit) {
+        st->paged = 1;
+        st->more = vm_list_from(&st->cursor, st->batch, cap, &st->n);
+        if (st->mode == LIST_LINE)
+            n = snprintf(outbuf, outsz, "200 OK %zu vms next=%zu", st->n, list_next_cursor(st));
+    } else if (st->mode == LIST_LINE) {
+        // the count is taken up front; VMs created during the walk are left out
+        vm_list(NULL, 0, &st->left);
+        n = snprintf(outbuf, outsz, "200 OK %zu vms", st->left);
+    }
+
+    int done;
+    n += list_fill(st, outbuf+n, outsz-n, &done);
+    stream_end(s);
+    if (done) free(st);
+    else s->stream = st;
+    return n;
+}
+
+int protocol_stream_next(proto_session_t *s, char *outbuf, size_t outsz) {
+    proto_stream_t *st = s->stream;
+    if (!st) return 0;
+    int done;
+    int n;
+    if (st->mode == STREAM_BUF) {
+        size_t k = st->blen - st->boff < outsz ? st->blen - st->boff : outsz;
+        memcpy(outbuf, st->buf + st->boff, k);
+        st->boff += k;
+        n = (int)k;
+        done = st->boff == st->blen;
+    } else {
+        n = list_fill(st, outbuf, outsz, &done);
+    }
+    if (st->stat_slot) stats_cmd_out(st->stat_slot - 1, (size_t)n);
+    if (done) stream_end(s);
+    return n;
+}
+
+static int cmd_vm_create(proto_session_t *s, const proto_req_t *req, char *outbuf, size_t outsz) {
+    const proto_kv_t *name = proto_arg(req, "name");
+    int mem = 0;
+    if (span_int(proto_arg(req, "mem")->val, &mem) != 0) return err(s, outbuf, outsz, "bad mem=");
+    char namebuf[sizeof(((vm_t*)0)->name)];
+    kv_copy(name, namebuf, sizeof(namebuf));
+    int id=0;
+    int rc = vm_create(namebuf, mem, &id);
+    if (rc!=0) return err(s, outbuf, outsz, "vm_create failed (%d)", rc);
+    return reply_id(s, outbuf, outsz, id);
+}
+
+static int cmd_vm_info(proto_session_t *s, const proto_req_t *req, char *outbuf, size_t outsz) {
+    int id = 0;
+    if (span_int(proto_arg(req, "id")->val, &id) != 0) return err(s, outbuf, outsz, "not found");
+    vm_t v;
+    int rc = vm_info(id, &v);
+    if (rc!=0) return err(s, outbuf, outsz, "not found");
+    return reply_vm(s, outbuf, outsz, &v);
+}
+
+static int cmd_vm_destroy(proto_session_t *s, const proto_req_t *req, char *outbuf, size_t outsz) {
+    int id = 0;
+    if (span_int(proto_arg(req, "id")->val, &id) != 0) return err(s, outbuf, outsz, "not found");
+    int rc = vm_destroy(id);
+    if (rc!=0) return err(s, outbuf, outsz, "not found");
+    return ok(s, outbuf, outsz, "destroyed id=%d", id);
+}
+
+// ----- BATCH -----
+// "BATCH n [atomic=1]" queues the next n commands (lines, or frames in
+// binary mode) and runs them back to back once the last one arrives. The
+// replies are collected in one buffer and leave together: every line is
+// tagged "#i " with the command's index (binary: a PB_T_TAG frame ahead of
+// each reply), and a summary line closes the batch. With atomic=1 the
+// store is held for the whole batch and the first failed command rolls
+// back everything before it; the rest are skipped.
+
+#define BATCH_MAX       10000
+#define BATCH_REPLY_MAX 4096     // per command, like a connection's RESP_MAX
+
+struct proto_batch {
+    int    atomic;
+    int    oom;         // a command could not be queued; the batch fails as a whole
+    size_t want, have;  // commands announced / queued
+    size_t len, cap;
+    char  *buf;         // per command: u32 length, then the line or frame payload
+};
+
+typedef struct {
+    char  *p;
+    size_t len, cap;
+    int    bol;         // next byte starts a line (text tagging)
+    int    oom;
+} rbuf_t;
+
+static int dispatch(proto_session_t *s, const proto_req_t *req, size_t inlen, int bad, char *outbuf, size_t outsz);
+static int frame_request(const char *frame, size_t len, proto_req_t *req);
+
+static void rb_put(rbuf_t *r, const char *src, size_t n) {
+    if (r->oom) return;
+    if (r->cap - r->len < n) {
+        size_t ncap = r->cap ? r->cap : 4096;
+        while (ncap - r->len < n) ncap *= 2;
+        char *np = realloc(r->p, ncap);
+        if (!np) { r->oom = 1; return; }
+        r->p = np;
+        r->cap = ncap;
+    }
+    memcpy(r->p + r->len, src, n);
+    r->len += n;
+}
+
+// Text: "#i " in front of every line of the reply.
+static void rb_tagged(rbuf_t *r, size_t idx, const char *src, size_t n) {
+    char tag[24];
+    int tl = snprintf(tag, sizeof(tag), "#%zu ", idx);
+    while (n > 0) {
+        if (r->bol) rb_put(r, tag, (size_t)tl);
+        const char *nl = memchr(src, '\n', n);
+        size_t k = nl ? (size_t)(nl - src) + 1 : n;
+        rb_put(r, src, k);
+        r->bol = nl != NULL;
+        src += k;
+        n -= k;
+    }
+}
+
+static void rb_tag_frame(rbuf_t *r, size_t idx) {
+    char f[FRAME_HDR + 4];
+    size_t n = frame_open(f, PB_OK, PB_T_TAG);
+    pb_put32((unsigned char *)f + n, (uint32_t)idx);
+    rb_put(r, f, (size_t)frame_close(f, n + 4));
+}
+
+// Hand a collected reply to the session as a prepared stream and return
+// its first part.
+static int reply_buf(proto_session_t *s, rbuf_t *r, char *out, size_t outsz) {
+    proto_stream_t *st = r->oom ? NULL : calloc(1, sizeof(*st));
+    if (!st) {
+        free(r->p);
+        return err(s, out, outsz, "out of memory");
+    }
+    st->mode = STREAM_BUF;
+    st->buf = r->p;
+    st->blen = r->len;
+    stream_end(s);
+    s->stream = st;
+    return protocol_stream_next(s, out, outsz);
+}
+
+static void batch_free(proto_batch_t *b) {
+    if (b) free(b->buf);
+    free(b);
+}
+
+static int cmd_batch(proto_session_t *s, const proto_req_t *req, char *out, size_t outsz) {
+    if (s->in_batch) return err(s, out, outsz, "BATCH does not nest");
+    const proto_kv_t *kv = req->nkv ? &req->kv[0] : NULL;
+    int n = 0, atomic = 0;
+    if (!kv || kv->key.len || span_int(kv->val, &n) != 0 || n < 1 || n > BATCH_MAX)
+        return err(s, out, outsz, "expected BATCH <1..%d> [atomic=1]", BATCH_MAX);
+    if ((kv = proto_arg(req, "atomic")) && (span_int(kv->val, &atomic) != 0 || atomic < 0 || atomic > 1))
+        return err(s, out, outsz, "bad atomic=");
+    proto_batch_t *b = calloc(1, sizeof(*b));
+    if (!b) return err(s, out, outsz, "out of memory");
+    b->atomic = atomic;
+    b->want = (size_t)n;
+    s->batch = b;
+    return 0;                   // nothing is sent until the batch has run
+}
+
+// Run every queued command, then send the collected replies as one
+// prepared stream.
+static int batch_run(proto_session_t *s, char *out, size_t outsz) {
+    proto_batch_t *b = s->batch;
+    s->batch = NULL;
+
+    rbuf_t r = { .bol = 1 };
+    char tmp[BATCH_REPLY_MAX];
+    proto_session_t sub = { .binary = s->binary, .in_batch = 1 };
+    size_t failed_at = SIZE_MAX;
+    int atomic = b->atomic && !b->oom && vm_batch_begin() == 0;
+
+    const char *p = b->buf;
+    for (size_t i=0; i<b->have && !b->oom; i++) {
+        uint32_t len;
+        memcpy(&len, p, sizeof(len));
+        const char *cmd = p + sizeof(len);
+        p = cmd + len;
+
+        int n;
+        if (failed_at != SIZE_MAX) {
+            n = err(&sub, tmp, sizeof(tmp), "skipped");
+        } else {
+            proto_req_t req;
+            int bad = s->binary ? frame_request(cmd, len, &req) : proto_tokenize(cmd, len, &req);
+            n = dispatch(&sub, &req, len, bad, tmp, sizeof(tmp));
+            if (n < 0) n = err(&sub, tmp, sizeof(tmp), "internal");
+            if (sub.failed && atomic) failed_at = i;
         }
-        if ((size_t)n < outsz-1) { outbuf[n++] = '\n'; outbuf[n]=0; }
-        return n;
-    } else if (strcmp(cmd, "VM.CREATE")==0) {
-        char copy[512]; strncpy(copy, rest, sizeof(copy)-1); copy[sizeof(copy)-1]=0;
-        const char *name = kv_get("name", copy, sizeof(copy));
-        const char *mems = kv_get("mem", copy, sizeof(copy));
-        if (!name || !mems) return err(outbuf, outsz, "missing name= or mem=");
-        int mem = atoi(mems);
-        int id=0;
-        int rc = vm_create(name, mem, &id);
-        if (rc!=0) return err(outbuf, outsz, "vm_create failed (%d)", rc);
-        return ok(outbuf, outsz, "id=%d", id);
-    } else if (strcmp(cmd, "VM.INFO")==0) {
-        char copy[512]; strncpy(copy, rest, sizeof(copy)-1); copy[sizeof(copy)-1]=0;
-        const char *ids = kv_get("id", copy, sizeof(copy));
-        if (!ids) return err(outbuf, outsz, "missing id=");
-        int id = atoi(ids);
-        vm_t v;
-        int rc = vm_info(id, &v);
-        if (rc!=0) return err(outbuf, outsz, "not found");
-        return ok(outbuf, outsz, "id=%d name=%s mem=%d state=%s", v.id, v.name, v.mem_mib, v.state);
-    } else if (strcmp(cmd, "VM.DESTROY")==0) {
-        char copy[512]; strncpy(copy, rest, sizeof(copy)-1); copy[sizeof(copy)-1]=0;
-        const char *ids = kv_get("id", copy, sizeof(copy));
-        if (!ids) return err(outbuf, outsz, "missing id=");
-        int id = atoi(ids);
-        int rc = vm_destroy(id);
-        if (rc!=0) return err(outbuf, outsz, "not found");
-        return ok(outbuf, outsz, "destroyed id=%d", id);
-    }
-
-    return err(outbuf, outsz, "unknown command");
+        if ((size_t)n >= sizeof(tmp)) {     // truncated: keep the line framing intact
+            n = (int)sizeof(tmp) - 1;
+            tmp[n-1] = '\n';
+        }
+        if (s->binary) rb_tag_frame(&r, i);
+        for (;;) {
+            if (s->binary) rb_put(&r, tmp, (size_t)n);
+            else rb_tagged(&r, i, tmp, (size_t)n);
+            if (!sub.stream) break;
+            n = protocol_stream_next(&sub, tmp, sizeof(tmp));
+        }
+    }
+    // a commit the journal cannot record is rolled back instead
+    int unjournaled = atomic && vm_batch_end(failed_at == SIZE_MAX) != 0 && failed_at == SIZE_MAX;
+    LOGD(LOG_SYS_PROTOCOL, "batch of %zu%s %s\n", b->have, b->atomic ? " (atomic)" : "",
+         failed_at == SIZE_MAX && !unjournaled ? "done" : "rolled back");
+
+    int n;
+    if (b->oom || r.oom) {
+        r.len = 0;
+        n = err(s, tmp, sizeof(tmp), "out of memory");
+    } else if (failed_at != SIZE_MAX) {
+        n = err(s, tmp, sizeof(tmp), "batch rolled back at #%zu", failed_at);
+    } else if (unjournaled) {
+        n = err(s, tmp, sizeof(tmp), "batch rolled back: journal write failed");
+    } else {
+        n = ok(s, tmp, sizeof(tmp), "batch %zu", b->have);
+    }
+    rb_put(&r, tmp, (size_t)n);
+    batch_free(b);
+    return reply_buf(s, &r, out, outsz);
+}
+
+// Queue one command of the batch being collected; runs the batch when it
+// is complete, otherwise answers nothing.
+static int batch_queue(proto_session_t *s, const char *cmd, size_t len, char *out, size_t outsz) {
+    proto_batch_t *b = s->batch;
+    uint32_t l32 = (uint32_t)len;
+    size_t need = sizeof(l32) + len;
+    if (!b->oom && b->cap - b->len < need) {
+        size_t ncap = b->cap ? b->cap : 1024;
+        while (ncap - b->len < need) ncap *= 2;
+        char *np = realloc(b->buf, ncap);
+        if (np) { b->buf = np; b->cap = ncap; }
+        else b->oom = 1;
+    }
+    if (!b->oom) {
+        memcpy(b->buf + b->len, &l32, sizeof(l32));
+        memcpy(b->buf + b->len + sizeof(l32), cmd, len);
+        b->len += need;
+    }
+    if (++b->have < b->want) return 0;
+    return batch_run(s, out, outsz);
+}
+
+void protocol_session_end(proto_session_t *s) {
+    stream_end(s);
+    batch_free(s->batch);
+    s->batch = NULL;
+}
+
+// ----- command table -----
+
+// Handlers run only after every `required` key was found in the request.
+typedef int (*cmd_fn)(proto_session_t *s, const proto_req_t *req, char *out, size_t outsz);
+
+typedef struct {
+    const char *verb;           // upper case
+    cmd_fn      fn;
+    const char *required[4];    // keys that must be present, checked before fn runs
+} cmd_t;
+
+static int cmd_stats(proto_session_t *s, const proto_req_t *req, char *out, size_t outsz);
+
+// Adding a command means adding a row here; lookup cost does not change.
+static const cmd_t commands[] = {
+    { "PING",       cmd_ping,       {0} },
+    { "VERSION",    cmd_version,    {0} },
+    { "HEALTH",     cmd_health,     {0} },
+    { "ECHO",       cmd_echo,       {0} },
+    { "SHUTDOWN",   cmd_shutdown,   {0} },
+    { "PROTO",      cmd_proto,      {0} },
+    { "BATCH",      cmd_batch,      {0} },
+    { "LOG.LEVEL",  cmd_log_level,  {0} },
+    { "STATS",      cmd_stats,      {0} },
+    { "VM.LIST",    cmd_vm_list,    {0} },
+    { "VM.CREATE",  cmd_vm_create,  { "name", "mem" } },
+    { "VM.INFO",    cmd_vm_info,    { "id" } },
+    { "VM.DESTROY", cmd_vm_destroy, { "id" } },
+};
+#define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
+
+#define VERB_MAX 16
+
+// One stats slot per commands[] row, plus one for unknown verbs.
+_Static_assert(NCOMMANDS + 1 <= STATS_MAX_CMDS, "raise STATS_MAX_CMDS");
+
+// Verbs bucketed by length, then told apart by first and last byte before
+// a single memcmp confirms the match: lookup never walks the whole table.
+static struct {
+    uint8_t n;
+    uint8_t idx[NCOMMANDS];
+} by_len[VERB_MAX + 1];
+static pthread_once_t index_once = PTHREAD_ONCE_INIT;
+
+static void build_index(void) {
+    for (size_t i=0;i<NCOMMANDS;i++) {
+        size_t len = strlen(commands[i].verb);
+        by_len[len].idx[by_len[len].n++] = (uint8_t)i;
+    }
+}
+
+static int cmd_lookup(const char *verb, size_t len) {
+    if (len == 0 || len > VERB_MAX) return -1;
+    for (uint8_t k=0; k<by_len[len].n; k++) {
+        int i = by_len[len].idx[k];
+        const char *v = commands[i].verb;
+        if (v[0] == verb[0] && v[len-1] == verb[len-1] && memcmp(v, verb, len) == 0) return i;
+    }
+    return -1;
+}
+
+static int check_required(proto_session_t *s, const cmd_t *c, const proto_req_t *req, char *out, size_t outsz) {
+    for (int k=0; k<4 && c->required[k]; k++) {
+        if (proto_arg(req, c->required[k])) continue;
+        // "missing name= or mem=" - every required key, like the handlers say
+        char msg[128];
+        size_t n = 0;
+        for (int j=0; j<4 && c->required[j]; j++) {
+            n += (size_t)snprintf(msg+n, sizeof(msg)-n, "%s%s=", j ? " or " : "", c->required[j]);
+            if (n >= sizeof(msg)) break;
+        }
+        return err(s, out, outsz, "missing %s", msg);
+    }
+    return 0;
+}
+
+size_t protocol_command_stats(protocol_cmd_stat_t *out, size_t max) {
+    size_t n = 0;
+    stats_cmd_t c;
+    for (size_t i=0; i<=NCOMMANDS && n<max; i++) {
+        stats_sum_cmd(i, &c);
+        protocol_cmd_stat_t *o = &out[n++];
+        o->verb       = i < NCOMMANDS ? commands[i].verb : "(unknown)";
+        o->calls      = c.calls;
+        o->errors     = c.errors;
+        o->bytes_in   = c.bytes_in;
+        o->bytes_out  = c.bytes_out;
+        o->lat_sum_ns = c.lat.sum;
+        o->p50_ns     = hist_quantile(&c.lat, 0.5);
+        o->p90_ns     = hist_quantile(&c.lat, 0.9);
+        o->p99_ns     = hist_quantile(&c.lat, 0.99);
+        o->p999_ns    = hist_quantile(&c.lat, 0.999);
+        o->max_ns     = c.lat.max;
+    }
+    return n;
+}
+
+// ----- STATS -----
+//   STATS               "STAT ..." server line, "CMD verb ..." per command used,
+//                       "JOURNAL ..." with persistence (batch sizes in records),
+//                       then "200 OK end commands=N"; latencies in ns
+//   STATS format=prom   Prometheus text exposition, then "200 OK end lines=N"
+// Binary mode sends each line as a PB_T_LINE frame. Rates are averages
+// since startup; a scraper derives current ones from the counters.
+
+#define STATS_LINE_MAX 512
+
+static void rb_line(rbuf_t *r, int binary, size_t *lines, const char *fmt, ...) {
+    char line[FRAME_HDR + STATS_LINE_MAX];
+    size_t n = binary ? frame_open(line, PB_OK, PB_T_LINE) : 0;
+    va_list ap;
+    va_start(ap, fmt);
+    int k = vsnprintf(line+n, STATS_LINE_MAX, fmt, ap);
+    va_end(ap);
+    n += k < 0 ? 0 : (size_t)k < STATS_LINE_MAX ? (size_t)k : STATS_LINE_MAX - 1;
+    if (binary) frame_close(line, n);
+    else line[n++] = '\n';
+    rb_put(r, line, n);
+    (*lines)++;
+}
+
+static void stats_prom(rbuf_t *r, int bin, size_t *lines, const stats_io_t *io,
+                       const protocol_cmd_stat_t *cs, size_t ncs) {
+    static const struct { const char *name, *type, *help; } hdr[] = {
+        { "hostd_uptime_seconds",           "gauge",   "Seconds since hostd started." },
+        { "hostd_connections_active",       "gauge",   "Open client connections." },
+        { "hostd_accepts_total",            "counter", "Client connections accepted." },
+        { "hostd_io_bytes_total",           "counter", "Bytes read from (dir=in) and written to (dir=out) clients." },
+        { "hostd_commands_total",           "counter", "Commands dispatched." },
+        { "hostd_command_errors_total",     "counter", "Commands answered with an error." },
+        { "hostd_command_bytes_total",      "counter", "Request (dir=in) and reply (dir=out) bytes per command." },
+        { "hostd_command_latency_seconds",  "summary", "Dispatch time per command." },
+        { "hostd_journal_commits_total",    "counter", "Journal group commits (one fdatasync each)." },
+        { "hostd_journal_records_total",    "counter", "Changes made durable; an atomic BATCH is one." },
+        { "hostd_journal_bytes_total",      "counter", "Bytes written to the journal." },
+        { "hostd_journal_pending",          "gauge",   "Changes applied but not yet durable." },
+        { "hostd_journal_batch_records",    "summary", "Records per group commit." },
+        { "hostd_journal_fsync_seconds",    "summary", "fdatasync time per group commit." },
+    };
+    #define PROM_HDR(i) do { \
+        rb_line(r, bin, lines, "# HELP %s %s", hdr[i].name, hdr[i].help); \
+        rb_line(r, bin, lines, "# TYPE %s %s", hdr[i].name, hdr[i].type); } while (0)
+
+    PROM_HDR(0); rb_line(r, bin, lines, "%s %.3f", hdr[0].name, stats_uptime());
+    PROM_HDR(1); rb_line(r, bin, lines, "%s %llu", hdr[1].name, (unsigned long long)(io->accepts - io->closes));
+    PROM_HDR(2); rb_line(r, bin, lines, "%s %llu", hdr[2].name, (unsigned long long)io->accepts);
+    PROM_HDR(3);
+    rb_line(r, bin, lines, "%s{dir=\"in\"} %llu", hdr[3].name, (unsigned long long)io->bytes_in);
+    rb_line(r, bin, lines, "%s{dir=\"out\"} %llu", hdr[3].name, (unsigned long long)io->bytes_out);
+    PROM_HDR(4);
+    for (size_t i=0;i<ncs;i++) rb_line(r, bin, lines, "%s{cmd=\"%s\"} %llu", hdr[4].name, cs[i].verb, cs[i].calls);
+    PROM_HDR(5);
+    for (size_t i=0;i<ncs;i++) rb_line(r, bin, lines, "%s{cmd=\"%s\"} %llu", hdr[5].name, cs[i].verb, cs[i].errors);
+    PROM_HDR(6);
+    for (size_t i=0;i<ncs;i++) {
+        rb_line(r, bin, lines, "%s{cmd=\"%s\",dir=\"in\"} %llu", hdr[6].name, cs[i].verb, cs[i].bytes_in);
+        rb_line(r, bin, lines, "%s{cmd=\"%s\",dir=\"out\"} %llu", hdr[6].name, cs[i].verb, cs[i].bytes_out);
+    }
+    PROM_HDR(7);
+    for (size_t i=0;i<ncs;i++) {
+        const char *name = hdr[7].name, *verb = cs[i].verb;
+        rb_line(r, bin, lines, "%s{cmd=\"%s\",quantile=\"0.5\"} %.9f", name, verb, cs[i].p50_ns / 1e9);
+        rb_line(r, bin, lines, "%s{cmd=\"%s\",quantile=\"0.9\"} %.9f", name, verb, cs[i].p90_ns / 1e9);
+        rb_line(r, bin, lines, "%s{cmd=\"%s\",quantile=\"0.99\"} %.9f", name, verb, cs[i].p99_ns / 1e9);
+        rb_line(r, bin, lines, "%s{cmd=\"%s\",quantile=\"0.999\"} %.9f", name, verb, cs[i].p999_ns / 1e9);
+        rb_line(r, bin, lines, "%s_sum{cmd=\"%s\"} %.9f", name, verb, cs[i].lat_sum_ns / 1e9);
+        rb_line(r, bin, lines, "%s_count{cmd=\"%s\"} %llu", name, verb, cs[i].calls);
+    }
+    vm_persist_stats_t js;
+    if (vm_persist_stats(&js) == 0) {
+        PROM_HDR(8);  rb_line(r, bin, lines, "%s %llu", hdr[8].name, js.commits);
+        PROM_HDR(9);  rb_line(r, bin, lines, "%s %llu", hdr[9].name, js.records);
+        PROM_HDR(10); rb_line(r, bin, lines, "%s %llu", hdr[10].name, js.bytes);
+        PROM_HDR(11); rb_line(r, bin, lines, "%s %llu", hdr[11].name, js.pending);
+        PROM_HDR(12);
+        rb_line(r, bin, lines, "%s{quantile=\"0.5\"} %llu", hdr[12].name, js.batch_p50);
+        rb_line(r, bin, lines, "%s{quantile=\"0.99\"} %llu", hdr[12].name, js.batch_p99);
+        rb_line(r, bin, lines, "%s_sum %llu", hdr[12].name, js.records);
+        rb_line(r, bin, lines, "%s_count %llu", hdr[12].name, js.commits);
+        PROM_HDR(13);
+        rb_line(r, bin, lines, "%s{quantile=\"0.5\"} %.9f", hdr[13].name, js.fsync_p50_ns / 1e9);
+        rb_line(r, bin, lines, "%s{quantile=\"0.99\"} %.9f", hdr[13].name, js.fsync_p99_ns / 1e9);
+        rb_line(r, bin, lines, "%s_sum %.9f", hdr[13].name, js.fsync_sum_ns / 1e9);
+        rb_line(r, bin, lines, "%s_count %llu", hdr[13].name, js.commits);
+    }
+    #undef PROM_HDR
+}
+
+static int cmd_stats(proto_session_t *s, const proto_req_t *req, char *out, size_t outsz) {
+    const proto_kv_t *kv = proto_arg(req, "format");
+    int prom = 0;
+    if (kv && kv->val.len == 4 && strncasecmp(kv->val.p, "prom", 4) == 0) prom = 1;
+    else if (kv && !(kv->val.len == 4 && strncasecmp(kv->val.p, "text", 4) == 0))
+        return err(s, out, outsz, "expected format=text|prom");
+
+    protocol_cmd_stat_t cs[NCOMMANDS + 1];
+    size_t ncs = protocol_command_stats(cs, NCOMMANDS + 1);
+    stats_io_t io;
+    stats_sum_io(&io);
+
+    rbuf_t r = {0};
+    size_t lines = 0, used = 0;
+    int bin = s->binary;
+    if (prom) {
+        stats_prom(&r, bin, &lines, &io, cs, ncs);
+    } else {
+        double up = stats_uptime();
+        rb_line(&r, bin, &lines, "STAT uptime=%.3f conns=%llu accepts=%llu accept_rate=%.2f bytes_in=%llu bytes_out=%llu",
+                up, (unsigned long long)(io.accepts - io.closes), (unsigned long long)io.accepts,
+                up > 0 ? (double)io.accepts / up : 0.0,
+                (unsigned long long)io.bytes_in, (unsigned long long)io.bytes_out);
+        for (size_t i=0;i<ncs;i++) {
+            const protocol_cmd_stat_t *c = &cs[i];
+            if (!c->calls) continue;
+            rb_line(&r, bin, &lines, "CMD %s calls=%llu errors=%llu bytes_in=%llu bytes_out=%llu"
+                    " p50=%llu p90=%llu p99=%llu p999=%llu max=%llu",
+                    c->verb, c->calls, c->errors, c->bytes_in, c->bytes_out,
+                    c->p50_ns, c->p90_ns, c->p99_ns, c->p999_ns, c->max_ns);
+            used++;
+        }
+        vm_persist_stats_t js;
+        if (vm_persist_stats(&js) == 0)
+            rb_line(&r, bin, &lines, "JOURNAL commits=%llu records=%llu bytes=%llu pending=%llu%s"
+                    " batch_p50=%llu batch_p99=%llu batch_max=%llu fsync_p50=%llu fsync_p99=%llu fsync_max=%llu",
+                    js.commits, js.records, js.bytes, js.pending, js.failed ? " failed=1" : "",
+                    js.batch_p50, js.batch_p99, js.batch_max, js.fsync_p50_ns, js.fsync_p99_ns, js.fsync_max_ns);
+    }
+    char tmp[128];
+    int n = prom ? ok(s, tmp, sizeof(tmp), "end lines=%zu", lines)
+                 : ok(s, tmp, sizeof(tmp), "end commands=%zu", used);
+    rb_put(&r, tmp, (size_t)n);
+    return reply_buf(s, &r, out, outsz);
+}
+
+static int dispatch(proto_session_t *s, const proto_req_t *req, size_t inlen, int bad, char *outbuf, size_t outsz) {
+    pthread_once(&index_once, build_index);
+
+    // verbs are case-insensitive; only the verb itself is copied
+    char verb[VERB_MAX];
+    int i = -1;
+    if (req->verb.len <= VERB_MAX) {
+        for (size_t k=0;k<req->verb.len;k++) verb[k] = (char)toupper((unsigned char)req->verb.p[k]);
+        i = cmd_lookup(verb, req->verb.len);
+    }
+    size_t slot = i < 0 ? NCOMMANDS : (size_t)i;
+    uint64_t t0 = stats_now_ns();
+
+    int n;
+    s->failed = 0;
+    if (i < 0) n = err(s, outbuf, outsz, "unknown command");
+    else if (bad) n = err(s, outbuf, outsz, "malformed arguments");
+    else if ((n = check_required(s, &commands[i], req, outbuf, outsz)) == 0)
+        n = commands[i].fn(s, req, outbuf, outsz);
+
+    int failed = n < 0 || s->failed;
+    stats_cmd(slot, failed, inlen, n > 0 ? (size_t)n : 0, stats_now_ns() - t0);
+    if (s->stream && !s->stream->stat_slot) s->stream->stat_slot = slot + 1;
+    LOGT(LOG_SYS_PROTOCOL, "%.*s args=%zu%s%s\n", (int)req->verb.len, req->verb.p, req->nkv,
+         s->binary ? " binary" : "", failed ? " failed" : "");
+    return n;
+}
+
+int protocol_handle(proto_session_t *s, const char *line, char *outbuf, size_t outsz) {
+    if (s->batch) return batch_queue(s, line, strlen(line), outbuf, outsz);
+    proto_req_t req;
+    size_t len = strlen(line);
+    int bad = proto_tokenize(line, len, &req);
+    return dispatch(s, &req, len, bad, outbuf, outsz);
+}
+
+// Binary request payload (proto_bin.h) into the same spans the tokenizer
+// produces. Values are raw bytes, never escaped; rest is the first value.
+static int frame_request(const char *frame, size_t len, proto_req_t *req) {
+    const unsigned char *p = (const unsigned char *)frame, *end = p + len;
+    memset(req, 0, sizeof(*req));
+    if (p == end || (size_t)(end - p) < 1u + p[0] + 1u) return -1;
+    req->verb.p = (const char *)p + 1;
+    req->verb.len = p[0];
+    p += 1 + p[0];
+    size_t nargs = *p++;
+    if (nargs > PROTO_MAX_ARGS) return -1;
+    for (size_t k=0; k<nargs; k++) {
+        proto_kv_t *kv = &req->kv[k];
+        if (end - p < 1 || (size_t)(end - p) < 1u + p[0] + 2u) return -1;
+        kv->key.p = (const char *)p + 1;
+        kv->key.len = p[0];
+        p += 1 + p[0];
+        size_t vlen = pb_get16(p);
+        p += 2;
+        if ((size_t)(end - p) < vlen) return -1;
+        kv->val.p = (const char *)p;
+        kv->val.len = vlen;
+        p += vlen;
+        req->nkv++;
+    }
+    if (p != end) return -1;
+    if (req->nkv) req->rest = req->kv[0].val;
+    return 0;
+}
+
+int protocol_handle_frame(proto_session_t *s, const char *frame, size_t len, char *outbuf, size_t outsz) {
+    if (s->batch) return batch_queue(s, frame, len, outbuf, outsz);
+    proto_req_t req;
+    int bad = frame_request(frame, len, &req);
+    return dispatch(s, &req, len, bad, outbuf, outsz);
+}
+
+int protocol_handle_line(const char *line, char *outbuf, size_t outsz) {
+    proto_session_t s = {0};
+    int n = protocol_handle(&s, line, outbuf, outsz);
+    while (n >= 0 && s.stream && (size_t)n + PROTO_STREAM_MIN <= outsz)
+        n += protocol_stream_next(&s, outbuf+n, outsz-n);
+    if (s.stream) {             // out of room: end the line where it stands
+        protocol_session_end(&s);
+        if (n > 0 && outbuf[n-1] != '\n') { outbuf[n++] = '\n'; outbuf[n] = 0; }
+    }
+    return n;
 }
@@ -1,12 +1,19 @@
-// server.c - UNIX and TCP server loop
+// server.c - UNIX and TCP server loop (edge-triggered epoll reactor)
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <stdint.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include <netinet/in.h>
@@ -14,15 +21,36 @@
 #include <netdb.h>
 
 #include "hostd.h"
-#include "protocol.h"
+#include "conn.h"
+#include "libvm.h"
+#include "server_uring.h"
 #include "log.h"
+#include "stats.h"
+
+#define MAX_EVENTS      256
+#define MAX_WORKERS     256
+
+typedef struct {
+    int     epfd;
+    conn_t *conns;
+    size_t  nconns;
+    conn_t *held;           // replies waiting for a journal commit
+    waker_t wake;
+    io_counters_t ctr;
+} loop_t;
+
+static int set_nonblock(int fd) {
+    int fl = fcntl(fd, F_GETFL, 0);
+    if (fl < 0) return -1;
+    return fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+}
 
 static int create_unix_listener(const char *path) {
     int fd = -1;
     struct sockaddr_un addr;
 
-    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
-        log_msg("socket(AF_UNIX) error: %s\n", strerror(errno));
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        LOGE(LOG_SYS_SERVER, "socket(AF_UNIX) error: %s\n", strerror(errno));
         return -1;
     }
 
@@ -32,12 +60,12 @@ static int create_unix_listener(const char *path) {
     // unlink existing
     unlink(path);
     if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        log_msg("bind(%s) error: %s\n", path, strerror(errno));
+        LOGE(LOG_SYS_SERVER, "bind(%s) error: %s\n", path, strerror(errno));
         close(fd);
         return -1;
     }
-    if (listen(fd, 16) < 0) {
-        log_msg("listen error: %s\n", strerror(errno));
+    if (listen(fd, SOMAXCONN) < 0) {
+        LOGE(LOG_SYS_SERVER, "listen error: %s\n", strerror(errno));
         close(fd);
         unlink(path);
         return -1;
@@ -47,12 +75,18 @@ static int create_unix_listener(const char *path) {
     return fd;
 }
 
-static int create_tcp_listener(const char *bind_host, int port) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) { log_msg("socket(AF_INET) error: %s\n", strerror(errno)); return -1; }
+static int create_tcp_listener(const char *bind_host, int port, int reuseport) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { LOGE(LOG_SYS_SERVER, "socket(AF_INET) error: %s\n", strerror(errno)); return -1; }
 
     int one = 1;
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // each worker binds its own socket; the kernel shards connections
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        LOGE(LOG_SYS_SERVER, "setsockopt(SO_REUSEPORT) error: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
 
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
@@ -65,7 +99,7 @@ static int create_tcp_listener(const char *bind_host, int port) {
             // try DNS
             struct hostent *he = gethostbyname(bind_host);
             if (!he || he->h_addrtype != AF_INET) {
-                log_msg("invalid bind host: %s\n", bind_host ? bind_host : "(null)");
+                LOGE(LOG_SYS_SERVER, "invalid bind host: %s\n", bind_host ? bind_host : "(null)");
                 close(fd);
                 return -1;
             }
@@ -74,87 +108,333 @@ static int create_tcp_listener(const char *bind_host, int port) {
     }
 
     if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        log_msg("bind(tcp) error: %s\n", strerror(errno));
+        LOGE(LOG_SYS_SERVER, "bind(tcp) error: %s\n", strerror(errno));
         close(fd);
         return -1;
     }
-    if (listen(fd, 64) < 0) {
-        log_msg("listen(tcp) error: %s\n", strerror(errno));
+    if (listen(fd, SOMAXCONN) < 0) {
+        LOGE(LOG_SYS_SERVER, "listen(tcp) error: %s\n", strerror(errno));
         close(fd);
         return -1;
     }
     return fd;
 }
 
-static void handle_client(int cfd) {
-    char inbuf[4096];
-    char outbuf[4096];
-    ssize_t n;
+// Write as much pending output as the socket accepts, one writev() per
+// batch of blocks. With EPOLLET the next EPOLLOUT edge resumes us once
+// the peer drains its receive window.
+static void conn_flush(loop_t *lp, conn_t *c) {
+    if (!conn_out_ready(c)) return;
+    while (c->opending > 0) {
+        struct iovec iov[MAX_IOV];
+        int cnt = conn_out_iov(c, iov, MAX_IOV);
+        lp->ctr.syscalls++;
+        ssize_t n = writev(c->fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) c->dead = 1;
+            return;
+        }
+        stats_write((size_t)n);
+        conn_out_consume(c, (size_t)n);
+    }
+}
 
-    while ((n = read(cfd, inbuf, sizeof(inbuf)-1)) > 0) {
-        inbuf[n] = 0;
+// Drain the socket until EAGAIN (required with EPOLLET), running complete
+// lines as they arrive, unless the client has too much unsent output
+// queued; then we stop and resume on EPOLLOUT.
+static void conn_on_readable(loop_t *lp, conn_t *c) {
+    c->rd_paused = 0;
+    for (;;) {
+        lp->ctr.requests += conn_process_input(c);
+        if (c->dead || c->rd_paused || c->eof) return;
+
+        struct iovec iov[2];
+        int cnt = conn_in_iov(c, iov);
+        lp->ctr.syscalls++;
+        ssize_t n = readv(c->fd, iov, cnt);
+        if (n > 0) { stats_read((size_t)n); conn_in_commit(c, (size_t)n); continue; }
+        if (n == 0) { c->eof = 1; continue; }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) c->dead = 1;
+        return;
+    }
+}
 
-        // process each line
-        char *saveptr = NULL;
-        char *line = strtok_r(inbuf, "\r\n", &saveptr);
-        while (line) {
-            if (*line == 0) { line = strtok_r(NULL, "\r\n", &saveptr); continue; }
+static void conn_close(loop_t *lp, conn_t *c) {
+    if (c->held) {
+        conn_t **pp = &lp->held;
+        while (*pp != c) pp = &(*pp)->hnext;
+        *pp = c->hnext;
+    }
+    epoll_ctl(lp->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    if (c->prev) c->prev->next = c->next; else lp->conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+    lp->nconns--;
+    stats_close();
+    LOGD(LOG_SYS_SERVER, "client disconnected (%s)\n", c->proto);
+    conn_free(c);
+}
 
-            int wr = protocol_handle_line(line, outbuf, sizeof(outbuf));
-            if (wr < 0) {
-                const char *err = "400 ERR internal\n";
-                write(cfd, err, strlen(err));
-            } else {
-                write(cfd, outbuf, wr);
-            }
-            line = strtok_r(NULL, "\r\n", &saveptr);
+static void accept_all(loop_t *lp, listener_t *l) {
+    for (;;) {
+        lp->ctr.syscalls++;
+        int cfd = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            // EMFILE/ENFILE/ENOBUFS: leave the rest in the backlog for later
+            LOGE(LOG_SYS_SERVER, "accept error (%s): %s\n", l->proto, strerror(errno));
+            return;
+        }
+        conn_t *c = conn_new(cfd, l->proto);
+        if (!c) { close(cfd); continue; }
+
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(lp->epfd, EPOLL_CTL_ADD, cfd, &ev) < 0) {
+            LOGE(LOG_SYS_SERVER, "epoll_ctl(add client) error: %s\n", strerror(errno));
+            close(cfd);
+            conn_free(c);
+            continue;
         }
+        c->next = lp->conns;
+        if (lp->conns) lp->conns->prev = c;
+        lp->conns = c;
+        lp->nconns++;
+        stats_accept();
+        LOGD(LOG_SYS_SERVER, "client connected (%s)\n", l->proto);
     }
 }
 
-int server_run(const char *sock_path) {
-    int lfd = create_unix_listener(sock_path);
-    if (lfd < 0) return 1;
+static void on_client_event(loop_t *lp, conn_t *c, uint32_t events) {
+    if (events & (EPOLLERR | EPOLLHUP)) c->dead = 1;
+    if (!c->dead && (events & (EPOLLIN | EPOLLRDHUP))) conn_on_readable(lp, c);
+    if (!c->dead) conn_flush(lp, c);
+    // output drained below the mark: resume the input we deferred earlier
+    while (!c->dead && c->rd_paused && c->opending < OUT_HIGH_WATER) {
+        conn_on_readable(lp, c);
+        if (!c->dead) conn_flush(lp, c);
+    }
+    // output held for the journal: the waker picks the connection up again
+    if (!c->dead && c->hold_lsn && !c->held) {
+        c->held = 1;
+        c->hnext = lp->held;
+        lp->held = c;
+    }
+    if (c->dead || (c->eof && !c->rd_paused && c->opending == 0)) conn_close(lp, c);
+}
 
-    log_msg("listening (unix) on %s\n", sock_path);
+// A journal commit finished: resume every connection it released.
+static void on_wake(loop_t *lp) {
+    uint64_t v;
+    lp->ctr.syscalls++;
+    if (read(lp->wake.fd, &v, sizeof(v)) < 0) {}
+    conn_t *c = lp->held;
+    lp->held = NULL;
+    while (c) {
+        conn_t *next = c->hnext;
+        c->held = 0;
+        int ready = conn_out_ready(c);      // or marks c dead
+        if (ready || c->dead) {
+            on_client_event(lp, c, 0);
+        } else {
+            c->held = 1;
+            c->hnext = lp->held;
+            lp->held = c;
+        }
+        c = next;
+    }
+}
+
+static void dispatch(loop_t *lp, struct epoll_event *evs, int n) {
+    for (int i=0;i<n;i++) {
+        src_kind_t kind = *(src_kind_t*)evs[i].data.ptr;
+        if (kind == SRC_LISTENER) accept_all(lp, (listener_t*)evs[i].data.ptr);
+        else if (kind == SRC_WAKE) on_wake(lp);
+        else on_client_event(lp, (conn_t*)evs[i].data.ptr, evs[i].events);
+    }
+}
+
+// Single reactor shared by every listener. Returns 0 on clean shutdown.
+static int event_loop(listener_t *ls, size_t nls, io_counters_t *ctr) {
+    loop_t lp = {0};
+    lp.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (lp.epfd < 0) {
+        LOGE(LOG_SYS_SERVER, "epoll_create1 error: %s\n", strerror(errno));
+        return 1;
+    }
+    for (size_t i=0;i<nls;i++) {
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLET | (ls[i].shared ? EPOLLEXCLUSIVE : 0);
+        ev.data.ptr = &ls[i];
+        if (set_nonblock(ls[i].fd) < 0 || epoll_ctl(lp.epfd, EPOLL_CTL_ADD, ls[i].fd, &ev) < 0) {
+            LOGE(LOG_SYS_SERVER, "epoll_ctl(add listener) error: %s\n", strerror(errno));
+            close(lp.epfd);
+            return 1;
+        }
+    }
+    // with persistence on, replies to changes wait for the journal's wakeups
+    lp.wake = (waker_t){ SRC_WAKE, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) };
+    if (lp.wake.fd >= 0) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &lp.wake };
+        if (vm_persist_notify(lp.wake.fd, 1) != 0 || epoll_ctl(lp.epfd, EPOLL_CTL_ADD, lp.wake.fd, &ev) < 0) {
+            vm_persist_notify(lp.wake.fd, 0);
+            close(lp.wake.fd);
+            lp.wake.fd = -1;
+        }
+    }
 
+    struct epoll_event evs[MAX_EVENTS];
+    int rc = 0;
     while (g_running) {
-        int cfd = accept(lfd, NULL, NULL);
-        if (cfd < 0) {
+        lp.ctr.syscalls++;
+        int n = epoll_wait(lp.epfd, evs, MAX_EVENTS, 1000);
+        if (n < 0) {
             if (errno == EINTR) continue;
-            log_msg("accept error (unix): %s\n", strerror(errno));
+            LOGE(LOG_SYS_SERVER, "epoll_wait error: %s\n", strerror(errno));
+            rc = 1;
             break;
         }
-        if (g_verbose) fprintf(stderr, "[hostd] client connected (unix)\n");
-        handle_client(cfd);
-        close(cfd);
-        if (g_verbose) fprintf(stderr, "[hostd] client disconnected (unix)\n");
+        dispatch(&lp, evs, n);
+    }
+
+    // Stop accepting, then give open clients a moment to read their last
+    // responses (e.g. the "bye" to SHUTDOWN) and hang up on their own.
+    for (size_t i=0;i<nls;i++) epoll_ctl(lp.epfd, EPOLL_CTL_DEL, ls[i].fd, NULL);
+    for (int waited = 0; rc == 0 && lp.nconns > 0 && waited < DRAIN_MS; waited += 50) {
+        int n = epoll_wait(lp.epfd, evs, MAX_EVENTS, 50);
+        if (n > 0) dispatch(&lp, evs, n);
     }
+    while (lp.conns) conn_close(&lp, lp.conns);
 
-    close(lfd);
-    unlink(sock_path);
-    return 0;
+    if (lp.wake.fd >= 0) {
+        vm_persist_notify(lp.wake.fd, 0);
+        close(lp.wake.fd);
+    }
+    close(lp.epfd);
+    *ctr = lp.ctr;
+    return rc;
 }
 
-int server_run_tcp(const char *bind_host, int bind_port) {
-    int lfd = create_tcp_listener(bind_host, bind_port);
-    if (lfd < 0) return 1;
+typedef struct {
+    int        id;
+    listener_t ls[2];
+    size_t     nls;
+    pthread_t  th;
+    int        rc;
+} worker_t;
 
-    log_msg("listening (tcp) on %s:%d\n", bind_host && bind_host[0]?bind_host:"0.0.0.0", bind_port);
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    io_counters_t ctr = {0};
+    const char *be = "epoll";
+#ifdef HOSTD_IO_URING
+    if (g_backend == SERVER_BACKEND_URING) {
+        w->rc = uring_loop(w->ls, w->nls, &ctr);
+        be = "io_uring";
+    } else
+#endif
+        w->rc = event_loop(w->ls, w->nls, &ctr);
+    LOGI(LOG_SYS_SERVER, "worker %d (%s): requests=%llu syscalls=%llu (%.3f per request)\n", w->id, be,
+            (unsigned long long)ctr.requests, (unsigned long long)ctr.syscalls,
+            ctr.requests ? (double)ctr.syscalls / (double)ctr.requests : 0.0);
+    // one worker failing takes the whole server down rather than limping on
+    if (w->rc != 0) g_running = 0;
+    return NULL;
+}
 
-    while (g_running) {
-        int cfd = accept(lfd, NULL, NULL);
-        if (cfd < 0) {
-            if (errno == EINTR) continue;
-            log_msg("accept error (tcp): %s\n", strerror(errno));
-            break;
+static void close_worker_listeners(worker_t *ws, int nw) {
+    for (int i=0;i<nw;i++) {
+        for (size_t k=0;k<ws[i].nls;k++) {
+            // the shared UNIX listener belongs to worker 0 only
+            if (ws[i].ls[k].shared && i > 0) continue;
+            close(ws[i].ls[k].fd);
+        }
+    }
+}
+
+int server_run_listeners(const char *sock_path, const char *bind_host, int bind_port, int nworkers) {
+    if (nworkers < 1) nworkers = 1;
+    if (nworkers > MAX_WORKERS) nworkers = MAX_WORKERS;
+
+    if (g_backend == SERVER_BACKEND_URING) {
+#ifdef HOSTD_IO_URING
+        if (!uring_supported()) {
+            LOGW(LOG_SYS_SERVER, "io_uring unavailable on this kernel; falling back to epoll\n");
+            g_backend = SERVER_BACKEND_EPOLL;
         }
-        if (g_verbose) fprintf(stderr, "[hostd] client connected (tcp)\n");
-        handle_client(cfd);
-        close(cfd);
-        if (g_verbose) fprintf(stderr, "[hostd] client disconnected (tcp)\n");
+#else
+        LOGW(LOG_SYS_SERVER, "built without io_uring support; falling back to epoll\n");
+        g_backend = SERVER_BACKEND_EPOLL;
+#endif
     }
 
-    close(lfd);
-    return 0;
+    worker_t *ws = calloc((size_t)nworkers, sizeof(*ws));
+    if (!ws) return 1;
+
+    int rc = 0;
+    int ufd = -1;
+    if (sock_path) {
+        // one UNIX socket, one accept queue; workers take turns via EPOLLEXCLUSIVE
+        ufd = create_unix_listener(sock_path);
+        if (ufd < 0) { free(ws); return 1; }
+        LOGI(LOG_SYS_SERVER, "listening (unix) on %s\n", sock_path);
+    }
+    int built = 0;
+    for (; built<nworkers; built++) {
+        worker_t *w = &ws[built];
+        w->id = built;
+        if (ufd >= 0) w->ls[w->nls++] = (listener_t){ SRC_LISTENER, ufd, "unix", nworkers > 1 };
+        if (bind_port > 0) {
+            int fd = create_tcp_listener(bind_host, bind_port, nworkers > 1);
+            if (fd < 0) { rc = 1; break; }
+            w->ls[w->nls++] = (listener_t){ SRC_LISTENER, fd, "tcp", 0 };
+        }
+    }
+    if (rc == 0 && bind_port > 0)
+        LOGI(LOG_SYS_SERVER, "listening (tcp) on %s:%d\n", bind_host && bind_host[0]?bind_host:"0.0.0.0", bind_port);
+    if (rc == 0 && ws[0].nls == 0) { LOGE(LOG_SYS_SERVER, "no listeners configured\n"); rc = 1; }
+
+    if (rc == 0) {
+        if (nworkers > 1) LOGI(LOG_SYS_SERVER, "starting %d workers\n", nworkers);
+
+        // Workers leave SIGINT/SIGTERM to the main thread (worker 0), which
+        // flips g_running; the others notice on their next epoll timeout.
+        sigset_t block, old;
+        sigemptyset(&block);
+        sigaddset(&block, SIGINT);
+        sigaddset(&block, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &block, &old);
+        int started = 1;
+        for (; started<nworkers; started++) {
+            int e = pthread_create(&ws[started].th, NULL, worker_main, &ws[started]);
+            if (e != 0) {
+                LOGE(LOG_SYS_SERVER, "pthread_create(worker %d) error: %s\n", started, strerror(e));
+                g_running = 0;
+                rc = 1;
+                break;
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+        worker_main(&ws[0]);
+        for (int i=1;i<started;i++) pthread_join(ws[i].th, NULL);
+        for (int i=0;i<started;i++) if (ws[i].rc != 0) rc = ws[i].rc;
+    }
+
+    close_worker_listeners(ws, built < nworkers ? built + 1 : nworkers);
+    if (sock_path) unlink(sock_path);
+    free(ws);
+    return rc;
+}
+
+int server_run(const char *sock_path) {
+    return server_run_listeners(sock_path, NULL, 0, 1);
+}
+
+int server_run_tcp(const char *bind_host, int bind_port) {
+    return server_run_listeners(NULL, bind_host, bind_port, 1);
 }
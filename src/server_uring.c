@@ -0,0 +1,514 @@
+// server_uring.c - io_uring backend for the server loop
+//
+// Same connection model as the epoll loop (conn.c framing and output
+// chain, protocol_handle_line dispatch), driven by completions instead of
+// readiness:
+//   - one multishot ACCEPT per listener
+//   - RECV with buffers picked by the kernel from a provided buffer ring
+//   - output flushed as WRITEV SQEs linked in order (IOSQE_IO_LINK)
+//   - a READ on the journal's eventfd releases replies held for a commit
+// Talks to the kernel through raw syscalls; liburing is not required.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+#include "hostd.h"
+#include "conn.h"
+#include "libvm.h"
+#include "server_uring.h"
+#include "log.h"
+#include "stats.h"
+
+#define RING_ENTRIES    1024
+#define BUF_GROUP       0
+#define NBUFS           512            // provided buffers per worker (power of two)
+#define BUF_SIZE        IN_RING
+#define WR_IOV_PER_SQE  16             // iovecs per linked WRITEV
+
+enum { OP_ACCEPT = 1, OP_RECV, OP_WRITE, OP_TIMEOUT, OP_CANCEL, OP_WAKE };
+#define UD(ptr, op)   ((uint64_t)(uintptr_t)(ptr) | (uint64_t)(op))
+#define UD_OP(ud)     ((int)((ud) & 7))
+#define UD_PTR(ud)    ((void*)(uintptr_t)((ud) & ~(uint64_t)7))
+
+typedef struct {
+    int fd;
+    void  *sq_ptr, *cq_ptr;
+    size_t sq_sz, cq_sz, sqes_sz;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_local_tail;     // SQEs prepared but not yet published
+    unsigned to_submit;
+
+    struct io_uring_buf_ring *br;
+    size_t br_sz;
+    char  *bufs;
+
+    struct __kernel_timespec ts;
+    conn_t *conns;
+    size_t  nconns;
+    conn_t *held;           // replies waiting for a journal commit
+    int     wake_fd;        // journal eventfd, -1 without persistence
+    uint64_t wake_val;
+    int     accepting;
+    io_counters_t ctr;
+} uring_t;
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned op, void *arg, unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+static void ring_teardown(uring_t *r) {
+    if (r->br) {
+        struct io_uring_buf_reg reg = {0};
+        reg.bgid = BUF_GROUP;
+        sys_register(r->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(r->br, r->br_sz);
+        r->br = NULL;
+    }
+    if (r->sqes) munmap(r->sqes, r->sqes_sz);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_sz);
+    if (r->sq_ptr) munmap(r->sq_ptr, r->sq_sz);
+    if (r->fd >= 0) close(r->fd);
+    free(r->bufs);
+    r->fd = -1;
+}
+
+static int ring_setup(uring_t *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = sys_setup(entries, &p);
+    if (r->fd < 0) return -1;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+        close(r->fd);
+        r->fd = -1;
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_sz > r->sq_sz) r->sq_sz = r->cq_sz;
+    r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) { r->sq_ptr = NULL; goto fail; }
+    r->cq_ptr = r->sq_ptr;
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) { r->sqes = NULL; goto fail; }
+
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_head  = (unsigned*)(sq + p.sq_off.head);
+    r->sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_mask  = (unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    r->cq_head  = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail  = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask  = (unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    r->sq_local_tail = *r->sq_tail;
+    return 0;
+fail:
+    ring_teardown(r);
+    return -1;
+}
+
+// Hand buffer `bid` (back) to the kernel's provided buffer ring.
+static void buf_recycle(uring_t *r, int bid) {
+    unsigned short tail = r->br->tail;
+    struct io_uring_buf *b = &r->br->bufs[tail & (NBUFS-1)];
+    b->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)bid * BUF_SIZE);
+    b->len  = BUF_SIZE;
+    b->bid  = (unsigned short)bid;
+    __atomic_store_n(&r->br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+static int bufs_setup(uring_t *r) {
+    r->br_sz = NBUFS * sizeof(struct io_uring_buf);
+    r->br = mmap(NULL, r->br_sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (r->br == MAP_FAILED) { r->br = NULL; return -1; }
+    r->bufs = malloc((size_t)NBUFS * BUF_SIZE);
+    if (!r->bufs) return -1;
+
+    struct io_uring_buf_reg reg = {0};
+    reg.ring_addr = (uint64_t)(uintptr_t)r->br;
+    reg.ring_entries = NBUFS;
+    reg.bgid = BUF_GROUP;
+    if (sys_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(r->br, r->br_sz);
+        r->br = NULL;
+        return -1;
+    }
+    r->br->tail = 0;
+    for (int i=0;i<NBUFS;i++) buf_recycle(r, i);
+    return 0;
+}
+
+static int ring_submit(uring_t *r, unsigned wait) {
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned n = r->to_submit;
+    r->to_submit = 0;
+    r->ctr.syscalls++;
+    int rc = sys_enter(r->fd, n, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+    if (rc < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN) return -1;
+    return 0;
+}
+
+static struct io_uring_sqe *get_sqe(uring_t *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sq_local_tail - head >= RING_ENTRIES) {
+        // SQ full: push what we have to the kernel first
+        ring_submit(r, 0);
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (r->sq_local_tail - head >= RING_ENTRIES) return NULL;
+    }
+    unsigned idx = r->sq_local_tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->sq_local_tail++;
+    r->to_submit++;
+    return sqe;
+}
+
+// ----- submissions -----
+
+static void arm_accept(uring_t *r, listener_t *l) {
+    struct io_uring_sqe *sqe = get_sqe(r);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = l->fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = UD(l, OP_ACCEPT);
+}
+
+static void arm_timeout(uring_t *r, long ms) {
+    struct io_uring_sqe *sqe = get_sqe(r);
+    if (!sqe) return;
+    r->ts.tv_sec = ms / 1000;
+    r->ts.tv_nsec = (ms % 1000) * 1000000L;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&r->ts;
+    sqe->len = 1;
+    sqe->user_data = UD(NULL, OP_TIMEOUT);
+}
+
+static void arm_wake(uring_t *r) {
+    struct io_uring_sqe *sqe = get_sqe(r);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = r->wake_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&r->wake_val;
+    sqe->len = sizeof(r->wake_val);
+    sqe->user_data = UD(NULL, OP_WAKE);
+}
+
+static void arm_recv(uring_t *r, conn_t *c) {
+    struct io_uring_sqe *sqe = get_sqe(r);
+    if (!sqe) { c->dead = 1; return; }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = UD(c, OP_RECV);
+    c->recv_armed = 1;
+    c->inflight++;
+}
+
+// Queue the whole pending output as WRITEVs of WR_IOV_PER_SQE iovecs each,
+// linked so the kernel runs them in order; a short write cancels the rest
+// of the chain and we resubmit from wherever it stopped.
+static void uring_flush(uring_t *r, conn_t *c) {
+    if (c->wr_inflight || c->opending == 0 || !conn_out_ready(c)) return;
+    int cnt = conn_out_iov(c, c->wiov, MAX_IOV);
+    for (int i=0; i<cnt; i+=WR_IOV_PER_SQE) {
+        struct io_uring_sqe *sqe = get_sqe(r);
+        if (!sqe) { if (!c->wr_inflight) c->dead = 1; return; }
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = c->fd;
+        sqe->addr = (uint64_t)(uintptr_t)&c->wiov[i];
+        sqe->len = (unsigned)(cnt - i < WR_IOV_PER_SQE ? cnt - i : WR_IOV_PER_SQE);
+        if (i + WR_IOV_PER_SQE < cnt) sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = UD(c, OP_WRITE);
+        c->wr_inflight++;
+        c->inflight++;
+    }
+}
+
+// ----- connection lifecycle -----
+
+static void conn_release(uring_t *r, conn_t *c) {
+    if (c->held) {
+        conn_t **pp = &r->held;
+        while (*pp != c) pp = &(*pp)->hnext;
+        *pp = c->hnext;
+    }
+    if (c->stash_bid >= 0) buf_recycle(r, c->stash_bid);
+    close(c->fd);
+    if (c->prev) c->prev->next = c->next; else r->conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+    r->nconns--;
+    stats_close();
+    LOGD(LOG_SYS_SERVER, "client disconnected (%s)\n", c->proto);
+    conn_free(c);
+}
+
+// Free the connection once it is finished and no SQE still references it.
+// A pending RECV is kicked loose with shutdown() so its CQE arrives.
+static void conn_settle(uring_t *r, conn_t *c) {
+    if (!c->dead && !(c->eof && !c->rd_paused && c->opending == 0)) return;
+    if (c->inflight == 0) { conn_release(r, c); return; }
+    if (!c->dead) c->dead = 1;
+    if (c->recv_armed) { r->ctr.syscalls++; shutdown(c->fd, SHUT_RDWR); }
+}
+
+// Move received bytes into the input ring, run complete lines, flush, and
+// re-arm the RECV when there is room and no backlog.
+static void conn_pump(uring_t *r, conn_t *c) {
+    c->rd_paused = 0;
+    while (!c->dead) {
+        if (c->stash_bid >= 0) {
+            struct iovec iov[2];
+            int cnt = conn_in_iov(c, iov);
+            const char *src = r->bufs + (size_t)c->stash_bid * BUF_SIZE + c->stash_off;
+            for (int i=0; i<cnt && c->stash_len > 0; i++) {
+                size_t k = iov[i].iov_len < c->stash_len ? iov[i].iov_len : c->stash_len;
+                memcpy(iov[i].iov_base, src, k);
+                conn_in_commit(c, k);
+                src += k;
+                c->stash_off += (uint32_t)k;
+                c->stash_len -= (uint32_t)k;
+            }
+            if (c->stash_len == 0) { buf_recycle(r, c->stash_bid); c->stash_bid = -1; }
+        }
+        r->ctr.requests += conn_process_input(c);
+        if (c->rd_paused || c->stash_bid < 0) break;
+    }
+    if (!c->dead) uring_flush(r, c);
+    if (!c->dead && !c->eof && !c->rd_paused && c->stash_bid < 0 && !c->recv_armed) arm_recv(r, c);
+    // output held for the journal: on_wake picks the connection up again
+    if (!c->dead && c->hold_lsn && !c->held) {
+        c->held = 1;
+        c->hnext = r->held;
+        r->held = c;
+    }
+}
+
+static void on_accept(uring_t *r, listener_t *l, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE) && r->accepting) arm_accept(r, l);
+    if (cqe->res < 0) {
+        if (cqe->res != -ECANCELED && cqe->res != -EAGAIN && cqe->res != -EINTR && cqe->res != -ECONNABORTED)
+            LOGE(LOG_SYS_SERVER, "accept error (%s): %s\n", l->proto, strerror(-cqe->res));
+        return;
+    }
+    int cfd = cqe->res;
+    if (!r->accepting) { close(cfd); return; }
+    conn_t *c = conn_new(cfd, l->proto);
+    if (!c) { close(cfd); return; }
+    c->next = r->conns;
+    if (r->conns) r->conns->prev = c;
+    r->conns = c;
+    r->nconns++;
+    stats_accept();
+    LOGD(LOG_SYS_SERVER, "client connected (%s)\n", l->proto);
+    arm_recv(r, c);
+}
+
+static void on_recv(uring_t *r, conn_t *c, struct io_uring_cqe *cqe) {
+    c->inflight--;
+    c->recv_armed = 0;
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        int bid = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (c->dead) {
+            buf_recycle(r, bid);
+        } else {
+            c->stash_bid = bid;
+            c->stash_off = 0;
+            c->stash_len = (uint32_t)cqe->res;
+            stats_read((size_t)cqe->res);
+            conn_pump(r, c);
+        }
+    } else if (cqe->res == 0) {
+        c->eof = 1;
+        if (!c->dead) conn_pump(r, c);
+    } else if (cqe->res == -ENOBUFS) {
+        // every provided buffer is parked in some connection; try again
+        if (!c->dead) arm_recv(r, c);
+    } else {
+        c->dead = 1;
+    }
+    conn_settle(r, c);
+}
+
+static void on_write(uring_t *r, conn_t *c, struct io_uring_cqe *cqe) {
+    c->inflight--;
+    c->wr_inflight--;
+    if (cqe->res > 0) { stats_write((size_t)cqe->res); conn_out_consume(c, (size_t)cqe->res); }
+    else if (cqe->res < 0 && cqe->res != -ECANCELED) c->dead = 1;
+    if (!c->dead && c->wr_inflight == 0) {
+        if (c->rd_paused && c->opending < OUT_HIGH_WATER) conn_pump(r, c);
+        else uring_flush(r, c);
+    }
+    conn_settle(r, c);
+}
+
+// A journal commit finished: resume every connection it released.
+static void on_wake(uring_t *r, struct io_uring_cqe *cqe) {
+    if (cqe->res != -ECANCELED) arm_wake(r);
+    conn_t *c = r->held;
+    r->held = NULL;
+    while (c) {
+        conn_t *next = c->hnext;
+        c->held = 0;
+        int ready = conn_out_ready(c);      // or marks c dead
+        if (!ready && !c->dead) {
+            c->held = 1;
+            c->hnext = r->held;
+            r->held = c;
+        } else {
+            if (!c->dead && c->rd_paused && c->opending < OUT_HIGH_WATER) conn_pump(r, c);
+            else if (!c->dead) uring_flush(r, c);
+            conn_settle(r, c);
+        }
+        c = next;
+    }
+}
+
+static void reap(uring_t *r) {
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        uint64_t ud = cqe->user_data;
+        switch (UD_OP(ud)) {
+            case OP_ACCEPT: on_accept(r, UD_PTR(ud), cqe); break;
+            case OP_RECV:   on_recv(r, UD_PTR(ud), cqe); break;
+            case OP_WRITE:  on_write(r, UD_PTR(ud), cqe); break;
+            case OP_TIMEOUT: if (g_running) arm_timeout(r, 1000); break;
+            case OP_WAKE:   on_wake(r, cqe); break;
+            default: break;
+        }
+        head++;
+        // release each slot right away: handlers may submit and wait
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+        tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+int uring_supported(void) {
+    uring_t r;
+    memset(&r, 0, sizeof(r));
+    if (ring_setup(&r, 8) != 0) return 0;
+
+    int ok = 0;
+    size_t psz = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, psz);
+    if (probe && sys_register(r.fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        const int need[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_WRITEV,
+                             IORING_OP_TIMEOUT, IORING_OP_ASYNC_CANCEL, IORING_OP_READ };
+        ok = 1;
+        for (size_t i=0;i<sizeof(need)/sizeof(need[0]);i++) {
+            if (need[i] > probe->last_op || !(probe->ops[need[i]].flags & IO_URING_OP_SUPPORTED)) ok = 0;
+        }
+    }
+    free(probe);
+    // provided buffer rings arrived with multishot accept (5.19)
+    if (ok && bufs_setup(&r) != 0) ok = 0;
+    ring_teardown(&r);
+    return ok;
+}
+
+int uring_loop(listener_t *ls, size_t nls, io_counters_t *ctr) {
+    uring_t *r = calloc(1, sizeof(*r));
+    if (!r) return 1;
+    r->fd = -1;
+    if (ring_setup(r, RING_ENTRIES) != 0 || bufs_setup(r) != 0) {
+        LOGE(LOG_SYS_SERVER, "io_uring setup error: %s\n", strerror(errno));
+        ring_teardown(r);
+        free(r);
+        return 1;
+    }
+
+    // with persistence on, replies to changes wait for the journal's wakeups
+    r->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (r->wake_fd >= 0 && vm_persist_notify(r->wake_fd, 1) != 0) {
+        close(r->wake_fd);
+        r->wake_fd = -1;
+    }
+    if (r->wake_fd >= 0) arm_wake(r);
+
+    r->accepting = 1;
+    for (size_t i=0;i<nls;i++) arm_accept(r, &ls[i]);
+    arm_timeout(r, 1000);
+
+    int rc = 0;
+    while (g_running) {
+        if (ring_submit(r, 1) != 0) {
+            LOGE(LOG_SYS_SERVER, "io_uring_enter error: %s\n", strerror(errno));
+            rc = 1;
+            break;
+        }
+        reap(r);
+    }
+
+    // Stop accepting, then give open clients a moment to read their last
+    // responses and hang up on their own, as the epoll loop does.
+    r->accepting = 0;
+    for (size_t i=0;i<nls;i++) {
+        struct io_uring_sqe *sqe = get_sqe(r);
+        if (!sqe) break;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = UD(&ls[i], OP_ACCEPT);
+        sqe->user_data = UD(NULL, OP_CANCEL);
+    }
+    for (int waited = 0; rc == 0 && r->nconns > 0 && waited < DRAIN_MS; waited += 50) {
+        arm_timeout(r, 50);
+        if (ring_submit(r, 1) != 0) break;
+        reap(r);
+    }
+    for (conn_t *c = r->conns, *nx; c; c = nx) {
+        nx = c->next;
+        c->dead = 1;
+        conn_settle(r, c);
+    }
+    for (int spins = 0; r->nconns > 0 && spins < 20; spins++) {
+        arm_timeout(r, 50);
+        if (ring_submit(r, 1) != 0) break;
+        reap(r);
+    }
+
+    *ctr = r->ctr;
+    // Tearing down the ring cancels whatever is still queued.
+    ring_teardown(r);
+    if (r->wake_fd >= 0) {
+        vm_persist_notify(r->wake_fd, 0);
+        close(r->wake_fd);
+    }
+    while (r->conns) {
+        conn_t *c = r->conns;
+        r->conns = c->next;
+        close(c->fd);
+        conn_free(c);
+    }
+    free(r);
+    return rc;
+}
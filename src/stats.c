@@ -0,0 +1,85 @@
+// stats.c - per-thread counter shards
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+typedef struct shard {
+    struct shard *next;
+    stats_io_t    io;
+    stats_cmd_t   cmd[STATS_MAX_CMDS];
+} shard_t;
+
+static shard_t *shards;                 // newest first; never unlinked
+static pthread_mutex_t reg_mu = PTHREAD_MUTEX_INITIALIZER;
+static __thread shard_t *local;
+static shard_t  spare;                  // absorbs updates if a shard cannot be allocated
+static uint64_t start_ns;
+
+uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void stats_init(void) { start_ns = stats_now_ns(); }
+
+double stats_uptime(void) { return (double)(stats_now_ns() - start_ns) / 1e9; }
+
+static shard_t *shard(void) {
+    if (local) return local;
+    shard_t *s = calloc(1, sizeof(*s));
+    if (!s) return &spare;      // racy, but only ever after malloc failed
+    pthread_mutex_lock(&reg_mu);
+    s->next = shards;
+    __atomic_store_n(&shards, s, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&reg_mu);
+    return local = s;
+}
+
+// Only this thread writes its shard: a relaxed load/store pair is enough.
+static inline void bump(uint64_t *p, uint64_t d) {
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + d, __ATOMIC_RELAXED);
+}
+
+void stats_cmd(size_t slot, int failed, size_t in, size_t out, uint64_t ns) {
+    stats_cmd_t *c = &shard()->cmd[slot];
+    bump(&c->calls, 1);
+    if (failed) bump(&c->errors, 1);
+    bump(&c->bytes_in, in);
+    bump(&c->bytes_out, out);
+    hist_record(&c->lat, ns);
+}
+
+void stats_cmd_out(size_t slot, size_t out) { bump(&shard()->cmd[slot].bytes_out, out); }
+
+void stats_accept(void)    { bump(&shard()->io.accepts, 1); }
+void stats_close(void)     { bump(&shard()->io.closes, 1); }
+void stats_read(size_t n)  { bump(&shard()->io.bytes_in, n); }
+void stats_write(size_t n) { bump(&shard()->io.bytes_out, n); }
+
+static uint64_t get(const uint64_t *p) { return __atomic_load_n(p, __ATOMIC_RELAXED); }
+
+void stats_sum_cmd(size_t slot, stats_cmd_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (shard_t *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s; s = s->next) {
+        const stats_cmd_t *c = &s->cmd[slot];
+        out->calls += get(&c->calls);
+        out->errors += get(&c->errors);
+        out->bytes_in += get(&c->bytes_in);
+        out->bytes_out += get(&c->bytes_out);
+        hist_merge(&out->lat, &c->lat);
+    }
+}
+
+void stats_sum_io(stats_io_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (shard_t *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s; s = s->next) {
+        out->accepts += get(&s->io.accepts);
+        out->closes += get(&s->io.closes);
+        out->bytes_in += get(&s->io.bytes_in);
+        out->bytes_out += get(&s->io.bytes_out);
+    }
+}